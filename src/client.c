@@ -21,10 +21,27 @@
 #include "client_fifo.h"
 #include "client_render.h"
 #include "client_stats.h"
+#include "client_local.h"
 #include "shared.h"
 
+// The server may run in another directory, so relative paths in a job are
+// resolved against the client's.
+static int make_absolute(char *path, size_t cap) {
+    if (!path[0] || path[0] == '/') return 1;
+    char cwd[4096];
+    char buf[8192];
+    if (!getcwd(cwd, sizeof(cwd))) return 0;
+    int n = snprintf(buf, sizeof(buf), "%s/%s", cwd, path);
+    if (n < 0 || (size_t)n >= cap) return 0;
+    memcpy(path, buf, (size_t)n + 1);
+    return 1;
+}
+
 int main(int argc, char **argv) {
     int force_menu = 0;
+    // A server this process started may be handed a new job even while its
+    // previous one runs; anyone else's only once it is idle.
+    char spawned_sock[256] = "";
     for (;;) {
         const char *mode = NULL;
         const char *sock_path = NULL;
@@ -36,12 +53,13 @@ int main(int argc, char **argv) {
         int obstacle_mode = 0;
         float obstacle_density = 0.0f;
         char obstacle_file[256] = "";
+        char base_file[256] = "";
         int delay_ms = 10;
         int replications = 100;
         int max_steps    = 100;
         float pU=0.25f, pD=0.25f, pL=0.25f, pR=0.25f;
         char output_path[256];
-        snprintf(output_path, sizeof(output_path), "replication_results.csv");
+        snprintf(output_path, sizeof(output_path), "replication_results.rwr");
         float *replay_prob = NULL;
         float *replay_avg = NULL;
         int replay_w = 0;
@@ -52,7 +70,8 @@ int main(int argc, char **argv) {
         float *display_avg = NULL;
         int restart_to_menu = 0;
 
-        if (argc < 3 || force_menu) {
+        int cli_local = (argc == 2 && strcmp(argv[1], "--local") == 0);
+        if ((argc < 3 && !cli_local) || force_menu) {
             start_on_client = 1;
             while (1) {
                 MenuAction act = run_main_menu();
@@ -105,6 +124,7 @@ int main(int argc, char **argv) {
                     replay_w = file_w;
                     replay_h = file_h;
                     replay_replications = file_reps;
+                    copy_path(base_file, sizeof(base_file), rcfg.input_path);
                     have_replay_stats = 1;
                     break;
                 }
@@ -128,7 +148,7 @@ int main(int argc, char **argv) {
                 copy_path(new_sock, sizeof(new_sock), cfg.sock_path);
                     strncpy(output_path, cfg.output_path, sizeof(output_path) - 1);
                     output_path[sizeof(output_path) - 1] = '\0';
-                    mode = "--new";
+                    mode = (new_sock[0] == '\0') ? "--local" : "--new";
                     sock_path = new_sock;
                     break;
                 } else {
@@ -144,7 +164,7 @@ int main(int argc, char **argv) {
             }
         } else {
             mode = argv[1];
-            sock_path = argv[2];
+            sock_path = cli_local ? "" : argv[2];
         }
 
     const char *server_bin = getenv("SERVER_BIN");
@@ -153,33 +173,113 @@ int main(int argc, char **argv) {
     uint32_t last_step_index = 0;
 
 
+    if (!make_absolute(output_path, sizeof(output_path)) ||
+        !make_absolute(obstacle_file, sizeof(obstacle_file)) ||
+        !make_absolute(base_file, sizeof(base_file))) {
+        fprintf(stderr, "File paths must fit in %zu bytes as absolute paths.\n", sizeof(output_path) - 1);
+        free(replay_prob);
+        free(replay_avg);
+        return 1;
+    }
+
+    MsgJob job;
+    memset(&job, 0, sizeof(job));
+    job.world_w = world_w;
+    job.world_h = world_h;
+    job.step_delay_ms = delay_ms;
+    job.replications = replications;
+    job.max_steps = max_steps;
+    job.pU = pU; job.pD = pD; job.pL = pL; job.pR = pR;
+    job.base_replications = replay_replications;
+    job.obstacle_mode = obstacle_mode;
+    job.obstacle_density = obstacle_density;
+    job.mode = MODE_INTERACTIVE;
+    snprintf(job.obstacle_file, sizeof(job.obstacle_file), "%s", obstacle_file);
+    snprintf(job.results_path, sizeof(job.results_path), "%s", output_path);
+    snprintf(job.base_file, sizeof(job.base_file), "%s", base_file);
+    const char *budget_env = getenv("RW_BUDGET_SECS");
+    job.budget_secs = (budget_env && *budget_env) ? atoi(budget_env) : 0;
+
+    // "path#session" names a session on a multi-session server.
+    char session_id[RWALK_SESSION_MAX] = "";
+    char host_sock[256];
+    const char *mark = strchr(sock_path, '#');
+    if (mark) {
+        snprintf(session_id, sizeof(session_id), "%s", mark + 1);
+        snprintf(host_sock, sizeof(host_sock), "%.*s", (int)(mark - sock_path), sock_path);
+        sock_path = host_sock;
+    }
+    const char *prio_env = getenv("RW_PRIORITY");
+    uint32_t priority = (prio_env && *prio_env) ? (uint32_t)atoi(prio_env) : 0;
+
+    int local = (strcmp(mode, "--local") == 0);
     int spawned_server = (strcmp(mode, "--new") == 0);
+    int fd = -1;
     if (spawned_server) {
+        fd = connect_unix(sock_path);
+        if (fd < 0 && session_id[0] && spawn_host(server_bin, sock_path) == 0) {
+            copy_path(spawned_sock, sizeof(spawned_sock), sock_path);
+            fd = connect_unix(sock_path);
+        }
+        if (fd >= 0 && session_id[0] && send_session(fd, session_id, priority) != 0) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0 && strcmp(spawned_sock, sock_path) != 0 && server_busy(fd, SPAWN_PROBE_MS)) {
+            fprintf(stderr, "The server at %s is running another job; use --join to watch it.\n",
+                    sock_path);
+            close(fd);
+            free(replay_prob);
+            free(replay_avg);
+            return 1;
+        }
+        if (fd >= 0 && send_job(fd, &job) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (spawned_server && fd < 0 && session_id[0]) {
+        fprintf(stderr, "No session server at %s\n", sock_path);
+        free(replay_prob);
+        free(replay_avg);
+        return 1;
+    } else if (spawned_server && fd < 0) {
         if (spawn_server(server_bin, sock_path, world_w, world_h, delay_ms, replications, max_steps,
                          pU, pD, pL, pR, output_path, replay_replications,
                          obstacle_mode, obstacle_density, obstacle_file,
-                         start_on_client) != 0) {
+                         start_on_client, base_file) != 0) {
             perror("spawn_server");
             free(replay_prob);
             free(replay_avg);
             return 1;
         }
-    } else if (strcmp(mode, "--join") != 0) {
+        copy_path(spawned_sock, sizeof(spawned_sock), sock_path);
+    } else if (!local && !spawned_server && strcmp(mode, "--join") != 0) {
         fprintf(stderr, "Unknown mode %s\n", mode);
         free(replay_prob);
         free(replay_avg);
         return 2;
     }
 
-    int fd = connect_unix(sock_path);
-    if (fd < 0) {
-        perror("connect_unix");
-        free(replay_prob);
-        free(replay_avg);
-        return 1;
+    if (fd < 0 && !local) {
+        fd = connect_unix(sock_path);
+        if (fd < 0) {
+            perror("connect_unix");
+            free(replay_prob);
+            free(replay_avg);
+            return 1;
+        }
+        if (session_id[0]) {
+            send_session(fd, session_id, priority);
+        }
+        if (spawned_server) {
+            send_mode(fd, MODE_INTERACTIVE);
+        }
     }
-    if (spawned_server) {
-        send_mode(fd, MODE_INTERACTIVE);
+
+    // Progress and stats beyond the 60 Hz redraw are never seen.
+    if (fd >= 0) {
+        send_subscribe(fd, SUB_ALL, 60, 60);
     }
 
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
@@ -323,8 +423,17 @@ int main(int argc, char **argv) {
     SDL_RenderClear(ren);
     SDL_SetRenderTarget(ren, NULL);
 
-    pthread_t th;
-    pthread_create(&th, NULL, net_thread, &C);
+    pthread_t th = 0;
+    if (local) {
+        C.local = local_engine_start(&C, &job);
+        if (!C.local) {
+            fprintf(stderr, "Failed to start the local engine.\n");
+            client_shutdown(&C, -1, th, canvas, ren, win, font);
+            return 1;
+        }
+    } else {
+        pthread_create(&th, NULL, net_thread, &C);
+    }
 
     int running = 1;
     int start_point_drawn = 0;
@@ -380,12 +489,14 @@ int main(int argc, char **argv) {
                 }
                 if (e.key.keysym.sym == SDLK_i) {
                     atomic_store(&C.mode, MODE_INTERACTIVE);
-                    send_mode(C.sockfd, MODE_INTERACTIVE);
+                    if (C.local) local_engine_set_mode(C.local, MODE_INTERACTIVE);
+                    else send_mode(C.sockfd, MODE_INTERACTIVE);
                 }
                 if (e.key.keysym.sym == SDLK_s) {
                     atomic_store(&C.mode, MODE_SUMMARY);
                     C.stats_dirty = 1;
-                    send_mode(C.sockfd, MODE_SUMMARY);
+                    if (C.local) local_engine_set_mode(C.local, MODE_SUMMARY);
+                    else send_mode(C.sockfd, MODE_SUMMARY);
                 }
                 if (e.key.keysym.sym == SDLK_n) {
                     C.show_stats_numbers = !C.show_stats_numbers;
@@ -407,7 +518,7 @@ int main(int argc, char **argv) {
 
                 }
                 if (e.key.keysym.sym == SDLK_q) {
-                    send_stop(C.sockfd);
+                    if (!C.local) send_stop(C.sockfd);
                     running = 0;
                 }
             }
@@ -423,9 +534,18 @@ int main(int argc, char **argv) {
         if ((int)mode_now != last_mode || atomic_exchange(&C.progress_dirty, 0)) {
             int cur = atomic_load(&C.current_replication);
             int base = C.have_base_stats ? C.base_replications : 0;
-            snprintf(title_buf, sizeof(title_buf),
-                     "Random Walk Client - Replication: %d / %d",
-                     cur + base, C.replications + base);
+            pthread_mutex_lock(&C.stats_mtx);
+            float precision = C.have_stats ? C.precision : 0.0f;
+            pthread_mutex_unlock(&C.stats_mtx);
+            if (precision > 0.0f) {
+                snprintf(title_buf, sizeof(title_buf),
+                         "Random Walk Client - Replication: %d / %d (+-%.4f)",
+                         cur + base, C.replications + base, (double)precision);
+            } else {
+                snprintf(title_buf, sizeof(title_buf),
+                         "Random Walk Client - Replication: %d / %d",
+                         cur + base, C.replications + base);
+            }
             SDL_SetWindowTitle(win, title_buf);
             last_mode = (int)mode_now;
         }
@@ -16,6 +16,32 @@ void fifo_push(StepFIFO *f, Step s)
     pthread_mutex_unlock(&f->mtx);
 }
 
+// One lock for a whole run; like fifo_push, the oldest steps give way when
+// the buffer is full.
+void fifo_push_steps(StepFIFO *f, const MsgStep *steps, int n)
+{
+    if (n > STEP_FIFO_CAP) {
+        steps += n - STEP_FIFO_CAP;
+        n = STEP_FIFO_CAP;
+    }
+
+    pthread_mutex_lock(&f->mtx);
+
+    int over = f->count + n - STEP_FIFO_CAP;
+    if (over > 0) {
+        f->tail = (f->tail + over) % STEP_FIFO_CAP;
+        f->count -= over;
+    }
+
+    for (int i = 0; i < n; i++) {
+        f->buf[f->head] = (Step){ .x = steps[i].x, .y = steps[i].y, .step_index = steps[i].step_index };
+        f->head = (f->head + 1) % STEP_FIFO_CAP;
+    }
+    f->count += n;
+
+    pthread_mutex_unlock(&f->mtx);
+}
+
 int fifo_pop(StepFIFO *f, Step *out)
 {
     pthread_mutex_lock(&f->mtx);
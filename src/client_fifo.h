@@ -1,6 +1,8 @@
 #pragma once
 
 #include "client_types.h"
+#include "shared.h"
 
 void fifo_push(StepFIFO *f, Step s);
+void fifo_push_steps(StepFIFO *f, const MsgStep *steps, int n);
 int fifo_pop(StepFIFO *f, Step *out);
@@ -0,0 +1,107 @@
+#include "client_local.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client_net.h"
+#include "server_types.h"
+#include "server_job.h"
+#include "server_net.h"
+#include "server_sim.h"
+#include "server_showcase.h"
+
+struct LocalEngine {
+    Server S;
+};
+
+// Frames from the engine go straight into the client's state on the
+// simulation thread; nothing is serialized or copied through a socket.
+static void local_emit(void *ctx, uint32_t type, const void *payload, uint32_t len) {
+    client_handle_msg((ClientState*)ctx, type, (const uint8_t*)payload, len);
+}
+
+static void local_send_obstacles(Server *S, ClientState *C) {
+    if (!S->obstacles) return;
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+    size_t total_len = sizeof(MsgObstaclesHdr) + count;
+    uint8_t *buf = (uint8_t*)malloc(total_len);
+    if (!buf) return;
+    MsgObstaclesHdr hdr = { .world_w = (uint32_t)S->world_w, .world_h = (uint32_t)S->world_h };
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), S->obstacles, count);
+    client_handle_msg(C, MSG_OBSTACLES, buf, (uint32_t)total_len);
+    free(buf);
+}
+
+LocalEngine *local_engine_start(ClientState *C, const MsgJob *job) {
+    LocalEngine *L = (LocalEngine*)calloc(1, sizeof(*L));
+    if (!L) return NULL;
+    Server *S = &L->S;
+    pthread_mutex_init(&S->clients_mtx, NULL);
+    pthread_mutex_init(&S->job_mtx, NULL);
+    pthread_cond_init(&S->job_cv, NULL);
+
+    const char *seed_env = getenv("RW_SEED");
+    S->seed_fixed = (seed_env && *seed_env);
+    if (S->seed_fixed) {
+        S->seed = strtoull(seed_env, NULL, 10);
+    } else {
+        S->seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
+    const char *window = getenv("RW_HISTORY_WINDOW");
+    S->history_limit = (window && *window) ? atoi(window) : HISTORY_DEFAULT_WINDOW;
+    publish_config_env(S->publish_hz);
+
+    if (!job_validate(job) || !job_apply(S, job, NULL)) {
+        job_release(S);
+        free(L);
+        return NULL;
+    }
+
+    S->emit = local_emit;
+    S->emit_ctx = C;
+    atomic_store(&S->mode, (job->mode == MODE_SUMMARY) ? MODE_SUMMARY : MODE_INTERACTIVE);
+    atomic_store(&S->alive, 1);
+    atomic_store(&S->running, 1);
+    atomic_store(&S->sim_started, 1);
+
+    MsgWelcome w;
+    server_welcome(S, &w);
+    client_handle_msg(C, MSG_WELCOME, (const uint8_t*)&w, sizeof(w));
+    local_send_obstacles(S, C);
+
+    showcase_start(S);
+    if (pthread_create(&S->sim_th, NULL, sim_thread, S) != 0) {
+        showcase_stop(S);
+        job_release(S);
+        free(L);
+        return NULL;
+    }
+    return L;
+}
+
+void local_engine_set_mode(LocalEngine *L, uint32_t mode) {
+    if (mode != MODE_INTERACTIVE && mode != MODE_SUMMARY) return;
+    Server *S = &L->S;
+    MsgMode m = { .mode = mode };
+    atomic_store(&S->mode, mode);
+    clients_broadcast(S, MSG_MODE, &m, sizeof(m));
+}
+
+void local_engine_stop(LocalEngine *L) {
+    if (!L) return;
+    Server *S = &L->S;
+    atomic_store(&S->alive, 0);
+    atomic_store(&S->running, 0);
+    job_wake(S);
+    pthread_join(S->sim_th, NULL);
+    showcase_stop(S);
+    job_release(S);
+    pthread_mutex_destroy(&S->clients_mtx);
+    pthread_mutex_destroy(&S->job_mtx);
+    pthread_cond_destroy(&S->job_cv);
+    free(L);
+}
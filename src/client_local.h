@@ -0,0 +1,8 @@
+#pragma once
+
+#include "client_types.h"
+#include "shared.h"
+
+LocalEngine *local_engine_start(ClientState *C, const MsgJob *job);
+void local_engine_set_mode(LocalEngine *L, uint32_t mode);
+void local_engine_stop(LocalEngine *L);
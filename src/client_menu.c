@@ -7,6 +7,7 @@
 #include <sys/socket.h>
 
 #include "client_ui.h"
+#include "client_local.h"
 
 int run_new_sim_menu(NewSimConfig *cfg)
 {
@@ -59,10 +60,10 @@ int run_new_sim_menu(NewSimConfig *cfg)
     char sock_buf[256];
     char out_buf[256];
     snprintf(sock_buf, sizeof(sock_buf), "%s", MENU_DEFAULT_SOCK);
-    snprintf(out_buf, sizeof(out_buf), "replication_results.csv");
+    snprintf(out_buf, sizeof(out_buf), "replication_results.rwr");
 
     InputField fields[13];
-    fields[0] = (InputField){ "Socket:", sock_buf, sizeof(sock_buf), {0}, 0, 0 };
+    fields[0] = (InputField){ "Socket (empty = local):", sock_buf, sizeof(sock_buf), {0}, 0, 0 };
     fields[1] = (InputField){ "World width:", w_buf, sizeof(w_buf), {0}, 1, 0 };
     fields[2] = (InputField){ "World height:", h_buf, sizeof(h_buf), {0}, 1, 0 };
     fields[3] = (InputField){ "Obstacle mode (0/1/2):", obs_mode_buf, sizeof(obs_mode_buf), {0}, 1, 0 };
@@ -256,12 +257,6 @@ int run_new_sim_menu(NewSimConfig *cfg)
                 accepted = 0;
                 continue;
             }
-            if (sock_buf[0] == '\0') {
-                snprintf(error_msg, sizeof(error_msg), "Missing socket.");
-                running = 1;
-                accepted = 0;
-                continue;
-            }
             if (out_buf[0] == '\0') {
                 snprintf(error_msg, sizeof(error_msg), "Missing output file.");
                 running = 1;
@@ -331,8 +326,8 @@ int run_replay_menu(ReplayConfig *cfg)
     char in_buf[256];
     char rep_buf[32] = "100";
     char out_buf[256];
-    snprintf(in_buf, sizeof(in_buf), "replication_results.csv");
-    snprintf(out_buf, sizeof(out_buf), "replication_results.csv");
+    snprintf(in_buf, sizeof(in_buf), "replication_results.rwr");
+    snprintf(out_buf, sizeof(out_buf), "replication_results.rwr");
 
     InputField fields[3];
     fields[0] = (InputField){ "Input file:", in_buf, sizeof(in_buf), {0}, 0, 0 };
@@ -878,6 +873,10 @@ void client_shutdown(ClientState *C, int sockfd, pthread_t net_th,
     if (net_th) {
         pthread_join(net_th, NULL);
     }
+    if (C && C->local) {
+        local_engine_stop(C->local);
+        C->local = NULL;
+    }
     if (font) TTF_CloseFont(font);
     if (C && C->stats_font) TTF_CloseFont(C->stats_font);
     if (TTF_WasInit()) TTF_Quit();
@@ -1,8 +1,10 @@
 #include "client_net.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -10,12 +12,62 @@
 #include "protocol.h"
 #include "shared.h"
 #include "client_fifo.h"
+#include "step_batch.h"
 
 void send_stop(int sockfd) {
     MsgHdr h = { MSG_STOP, 0 };
     send_all(sockfd, &h, sizeof(h));
 }
 
+int send_job(int sockfd, const MsgJob *job) {
+    MsgHdr h = { MSG_JOB, (uint32_t)sizeof(*job) };
+    if (send_all(sockfd, &h, sizeof(h)) != 0) return -1;
+    return send_all(sockfd, job, sizeof(*job));
+}
+
+int send_session(int sockfd, const char *session_id, uint32_t priority) {
+    MsgSession m;
+    memset(&m, 0, sizeof(m));
+    snprintf(m.session_id, sizeof(m.session_id), "%s", session_id);
+    m.priority = priority;
+    MsgHdr h = { MSG_SESSION, (uint32_t)sizeof(m) };
+    if (send_all(sockfd, &h, sizeof(h)) != 0) return -1;
+    return send_all(sockfd, &m, sizeof(m));
+}
+
+int send_subscribe(int sockfd, uint32_t streams, uint32_t progress_hz, uint32_t stats_hz) {
+    MsgSubscribe m = { .streams = streams, .progress_hz = progress_hz, .stats_hz = stats_hz };
+    MsgHdr h = { MSG_SUBSCRIBE, (uint32_t)sizeof(m) };
+    if (send_all(sockfd, &h, sizeof(h)) != 0) return -1;
+    return send_all(sockfd, &m, sizeof(m));
+}
+
+// Reads the greeting of a server just connected to. Returns 1 when its
+// progress shows a job still running, 0 once it shows the job finished or
+// when nothing arrives within timeout_ms, as for a session with no job yet.
+int server_busy(int sockfd, int timeout_ms) {
+    for (;;) {
+        struct pollfd p = { .fd = sockfd, .events = POLLIN };
+        int pr = poll(&p, 1, timeout_ms);
+        if (pr < 0 && errno == EINTR) continue;
+        if (pr <= 0) return 0;
+
+        MsgHdr h;
+        if (recv_all(sockfd, &h, sizeof(h)) <= 0) return 0;
+        if (h.type == MSG_PROGRESS && h.len == sizeof(MsgProgress)) {
+            MsgProgress m;
+            if (recv_all(sockfd, &m, sizeof(m)) <= 0) return 0;
+            return m.current_replication < m.total_replications;
+        }
+        uint8_t skip[4096];
+        for (uint32_t left = h.len; left > 0; ) {
+            uint32_t n = (left < sizeof(skip)) ? left : (uint32_t)sizeof(skip);
+            if (recv_all(sockfd, skip, n) <= 0) return 0;
+            left -= n;
+        }
+    }
+}
+
 int connect_unix(const char *path) {
     int fd = socket(AF_UNIX, SOCK_STREAM, 0);
     if (fd < 0) return -1;
@@ -37,8 +89,127 @@ int connect_unix(const char *path) {
     return fd;
 }
 
+void client_handle_msg(ClientState *C, uint32_t type, const uint8_t *payload, uint32_t len) {
+    if (type == MSG_WELCOME && len == sizeof(MsgWelcome)) {
+        const MsgWelcome *w = (const MsgWelcome*)payload;
+        C->world_w = (int)w->world_w;
+        C->world_h = (int)w->world_h;
+        C->max_steps = (int)w->max_steps;
+        C->delay_ms = (int)w->step_delay_ms;
+        C->replications = (int)w->replications;
+        atomic_store(&C->mode, w->mode);
+        atomic_store(&C->have_welcome, 1);
+
+        pthread_mutex_lock(&C->pos_mtx);
+        C->have_pos = 0;
+        pthread_mutex_unlock(&C->pos_mtx);
+
+        pthread_mutex_lock(&C->stats_mtx);
+        C->have_obstacles = 0;
+        pthread_mutex_unlock(&C->stats_mtx);
+    } else if (type == MSG_STEP && len == sizeof(MsgStep)) {
+        const MsgStep *s = (const MsgStep*)payload;
+
+        Step st;
+        st.x = s->x;
+        st.y = s->y;
+        st.step_index = s->step_index;
+
+        fifo_push(&C->fifo, st);
+    } else if (type == MSG_STEPS) {
+        int n = steps_decode(payload, len, C->world_w, C->world_h, NULL);
+        MsgStep *steps = (n > 0) ? (MsgStep*)malloc((size_t)n * sizeof(*steps)) : NULL;
+        if (steps) {
+            steps_decode(payload, len, C->world_w, C->world_h, steps);
+            fifo_push_steps(&C->fifo, steps, n);
+            free(steps);
+        }
+    } else if (type == MSG_ERROR) {
+        fprintf(stderr, "Server: %.*s\n", (int)len, (const char*)payload);
+    } else if (type == MSG_MODE && len == sizeof(MsgMode)) {
+        const MsgMode *m = (const MsgMode*)payload;
+        atomic_store(&C->mode, m->mode);
+    } else if (type == MSG_PROGRESS && len == sizeof(MsgProgress)) {
+        const MsgProgress *p = (const MsgProgress*)payload;
+        // A budgeted run ends early and reports its final size here.
+        C->replications = (int)p->total_replications;
+        atomic_store(&C->current_replication, (int)p->current_replication);
+        atomic_store(&C->progress_dirty, 1);
+    } else if (type == MSG_STATS && len >= sizeof(MsgStatsHdr)) {
+        const MsgStatsHdr *sh = (const MsgStatsHdr*)payload;
+        uint32_t w = sh->world_w;
+        uint32_t hgt = sh->world_h;
+        size_t count = (size_t)w * (size_t)hgt;
+        size_t expected = sizeof(MsgStatsHdr) + count * sizeof(float) * 2u;
+        if (w > 0 && hgt > 0 && len == expected) {
+            const float *prob = (const float*)(payload + sizeof(MsgStatsHdr));
+            const float *avg = prob + count;
+            pthread_mutex_lock(&C->stats_mtx);
+            if (C->have_base_stats && (C->base_w != (int)w || C->base_h != (int)hgt)) {
+                free(C->base_prob);
+                free(C->base_avg);
+                C->base_prob = NULL;
+                C->base_avg = NULL;
+                C->base_w = C->base_h = 0;
+                C->base_replications = 0;
+                C->have_base_stats = 0;
+            }
+            if (C->stats_w != (int)w || C->stats_h != (int)hgt || !C->prob_to_center || !C->avg_steps_to_center) {
+                free(C->prob_to_center);
+                free(C->avg_steps_to_center);
+                C->prob_to_center = (float*)malloc(count * sizeof(float));
+                C->avg_steps_to_center = (float*)malloc(count * sizeof(float));
+                C->stats_w = (int)w;
+                C->stats_h = (int)hgt;
+            }
+            if (C->prob_to_center && C->avg_steps_to_center) {
+                memcpy(C->prob_to_center, prob, count * sizeof(float));
+                memcpy(C->avg_steps_to_center, avg, count * sizeof(float));
+                C->precision = sh->precision;
+                C->have_stats = 1;
+                C->stats_dirty = 1;
+                atomic_store(&C->progress_dirty, 1);
+            }
+            pthread_mutex_unlock(&C->stats_mtx);
+        }
+    } else if ((type == MSG_OBSTACLES || type == MSG_OBSTACLES_BITS) &&
+               len >= sizeof(MsgObstaclesHdr)) {
+        const MsgObstaclesHdr *oh = (const MsgObstaclesHdr*)payload;
+        uint32_t w = oh->world_w;
+        uint32_t hgt = oh->world_h;
+        size_t count = (size_t)w * (size_t)hgt;
+        int packed = (type == MSG_OBSTACLES_BITS);
+        size_t body = packed ? (count + 7u) / 8u : count * sizeof(uint8_t);
+        if (w > 0 && hgt > 0 && len == sizeof(MsgObstaclesHdr) + body) {
+            const uint8_t *obs = (const uint8_t*)(payload + sizeof(MsgObstaclesHdr));
+            pthread_mutex_lock(&C->stats_mtx);
+            if (C->obs_w != (int)w || C->obs_h != (int)hgt || !C->obstacles) {
+                free(C->obstacles);
+                C->obstacles = (uint8_t*)malloc(count * sizeof(uint8_t));
+                C->obs_w = (int)w;
+                C->obs_h = (int)hgt;
+            }
+            if (C->obstacles) {
+                if (packed) {
+                    for (size_t i = 0; i < count; i++) {
+                        C->obstacles[i] = (obs[i >> 3] >> (i & 7)) & 1u;
+                    }
+                } else {
+                    memcpy(C->obstacles, obs, count * sizeof(uint8_t));
+                }
+                C->have_obstacles = 1;
+                C->stats_dirty = 1;
+            }
+            pthread_mutex_unlock(&C->stats_mtx);
+        }
+    }
+}
+
+// One receive buffer for the connection, grown to the largest message.
 void *net_thread(void *arg) {
     ClientState *C = (ClientState*)arg;
+    uint8_t *payload = NULL;
+    uint32_t cap = 0;
 
     while (atomic_load(&C->running)) {
         MsgHdr h;
@@ -47,131 +218,21 @@ void *net_thread(void *arg) {
 
         if (h.len > (1024u * 1024u)) break;
 
-        uint8_t *payload = NULL;
+        if (h.len > cap) {
+            uint8_t *grown = (uint8_t*)realloc(payload, h.len);
+            if (!grown) break;
+            payload = grown;
+            cap = h.len;
+        }
         if (h.len) {
-            payload = (uint8_t*)malloc(h.len);
-            if (!payload) break;
             rr = recv_all(C->sockfd, payload, h.len);
-            if (rr <= 0) {
-                free(payload);
-                break;
-            }
-        }
-
-        if (h.type == MSG_WELCOME && h.len == sizeof(MsgWelcome)) {
-            MsgWelcome *w = (MsgWelcome*)payload;
-            C->world_w = (int)w->world_w;
-            C->world_h = (int)w->world_h;
-            C->max_steps = (int)w->max_steps;
-            C->delay_ms = (int)w->step_delay_ms;
-            C->replications = (int)w->replications;
-            atomic_store(&C->mode, w->mode);
-            atomic_store(&C->have_welcome, 1);
-
-            pthread_mutex_lock(&C->pos_mtx);
-            C->have_pos = 0;
-            pthread_mutex_unlock(&C->pos_mtx);
-        } else if (h.type == MSG_STEP && h.len == sizeof(MsgStep)) {
-            MsgStep *s = (MsgStep*)payload;
-
-            Step st;
-            st.x = s->x;
-            st.y = s->y;
-            st.step_index = s->step_index;
-
-            fifo_push(&C->fifo, st);
-        } else if (h.type == MSG_MODE && h.len == sizeof(MsgMode)) {
-            MsgMode *m = (MsgMode*)payload;
-            atomic_store(&C->mode, m->mode);
-        } else if (h.type == MSG_PROGRESS && h.len == sizeof(MsgProgress)) {
-            MsgProgress *p = (MsgProgress*)payload;
-            atomic_store(&C->current_replication, (int)p->current_replication);
-            atomic_store(&C->progress_dirty, 1);
-        } else if (h.type == MSG_STATS && h.len >= sizeof(MsgStatsHdr)) {
-            MsgStatsHdr *sh = (MsgStatsHdr*)payload;
-            uint32_t w = sh->world_w;
-            uint32_t hgt = sh->world_h;
-            size_t count = (size_t)w * (size_t)hgt;
-            size_t expected = sizeof(MsgStatsHdr) + count * sizeof(float) * 2u;
-            if (w > 0 && hgt > 0 && h.len == expected) {
-                float *prob = (float*)(payload + sizeof(MsgStatsHdr));
-                float *avg = prob + count;
-                pthread_mutex_lock(&C->stats_mtx);
-                if (C->have_base_stats && (C->base_w != (int)w || C->base_h != (int)hgt)) {
-                    free(C->base_prob);
-                    free(C->base_avg);
-                    C->base_prob = NULL;
-                    C->base_avg = NULL;
-                    C->base_w = C->base_h = 0;
-                    C->base_replications = 0;
-                    C->have_base_stats = 0;
-                }
-                if (C->stats_w != (int)w || C->stats_h != (int)hgt || !C->prob_to_center || !C->avg_steps_to_center) {
-                    free(C->prob_to_center);
-                    free(C->avg_steps_to_center);
-                    C->prob_to_center = (float*)malloc(count * sizeof(float));
-                    C->avg_steps_to_center = (float*)malloc(count * sizeof(float));
-                    C->stats_w = (int)w;
-                    C->stats_h = (int)hgt;
-                }
-                if (C->prob_to_center && C->avg_steps_to_center) {
-                    int new_reps = (int)atomic_load(&C->current_replication);
-                    int base_reps = C->have_base_stats ? C->base_replications : 0;
-                    if (C->have_base_stats && base_reps > 0 && new_reps > 0) {
-                        int total_reps = base_reps + new_reps;
-                        for (size_t i = 0; i < count; i++) {
-                            float prob0 = C->base_prob[i];
-                            float avg0 = C->base_avg[i];
-                            float success0 = prob0 * (float)base_reps;
-                            float steps0 = avg0 * success0;
-
-                            float prob1 = prob[i];
-                            float avg1 = avg[i];
-                            float success1 = prob1 * (float)new_reps;
-                            float steps1 = avg1 * success1;
-
-                            float success = success0 + success1;
-                            float steps = steps0 + steps1;
-
-                            C->prob_to_center[i] = (total_reps > 0) ? (success / (float)total_reps) : 0.0f;
-                            C->avg_steps_to_center[i] = (success > 0.0f) ? (steps / success) : 0.0f;
-                        }
-                    } else {
-                        memcpy(C->prob_to_center, prob, count * sizeof(float));
-                        memcpy(C->avg_steps_to_center, avg, count * sizeof(float));
-                    }
-                    C->have_stats = 1;
-                    C->stats_dirty = 1;
-                }
-                pthread_mutex_unlock(&C->stats_mtx);
-            }
-        } else if (h.type == MSG_OBSTACLES && h.len >= sizeof(MsgObstaclesHdr)) {
-            MsgObstaclesHdr *oh = (MsgObstaclesHdr*)payload;
-            uint32_t w = oh->world_w;
-            uint32_t hgt = oh->world_h;
-            size_t count = (size_t)w * (size_t)hgt;
-            size_t expected = sizeof(MsgObstaclesHdr) + count * sizeof(uint8_t);
-            if (w > 0 && hgt > 0 && h.len == expected) {
-                uint8_t *obs = (uint8_t*)(payload + sizeof(MsgObstaclesHdr));
-                pthread_mutex_lock(&C->stats_mtx);
-                if (C->obs_w != (int)w || C->obs_h != (int)hgt || !C->obstacles) {
-                    free(C->obstacles);
-                    C->obstacles = (uint8_t*)malloc(count * sizeof(uint8_t));
-                    C->obs_w = (int)w;
-                    C->obs_h = (int)hgt;
-                }
-                if (C->obstacles) {
-                    memcpy(C->obstacles, obs, count * sizeof(uint8_t));
-                    C->have_obstacles = 1;
-                    C->stats_dirty = 1;
-                }
-                pthread_mutex_unlock(&C->stats_mtx);
-            }
+            if (rr <= 0) break;
         }
 
-        if (payload) free(payload);
+        client_handle_msg(C, h.type, payload, h.len);
     }
 
+    free(payload);
     atomic_store(&C->running, 0);
     return NULL;
 }
@@ -1,8 +1,14 @@
 #pragma once
 
 #include "client_types.h"
+#include "shared.h"
 
 int connect_unix(const char *path);
+int server_busy(int sockfd, int timeout_ms);
 void send_stop(int sockfd);
+int send_job(int sockfd, const MsgJob *job);
+int send_session(int sockfd, const char *session_id, uint32_t priority);
+int send_subscribe(int sockfd, uint32_t streams, uint32_t progress_hz, uint32_t stats_hz);
 void send_mode(int sockfd, uint32_t mode);
+void client_handle_msg(ClientState *C, uint32_t type, const uint8_t *payload, uint32_t len);
 void *net_thread(void *arg);
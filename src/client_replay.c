@@ -3,148 +3,253 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "client_ui.h"
+#include "results_io.h"
 
-static int token_is_number(const char *s) {
-    if (!s || *s == '\0') return 0;
-    char *end = NULL;
-    strtof(s, &end);
-    return end && *end == '\0';
+#define REPLAY_MAX_THREADS 16
+#define REPLAY_MIN_CHUNK (256u * 1024u)
+
+typedef struct {
+    const char *begin;
+    const char *end;
+    int w, h;
+    float *prob;
+    float *avg;
+} ReplayChunk;
+
+static const char *parse_int_fast(const char *p, const char *end, int *out) {
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    if (p >= end || *p < '0' || *p > '9') return NULL;
+    int v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+    }
+    *out = neg ? -v : v;
+    return p;
 }
 
-int load_replay_file(const char *path, int *out_w, int *out_h, int *out_max_steps,
-                     float *out_pU, float *out_pD, float *out_pL, float *out_pR,
-                     int *out_replications, int *out_obstacle_mode,
-                     float *out_obstacle_density,
-                     char *out_obstacle_file, size_t out_obstacle_file_cap,
-                     char *out_sock, size_t out_sock_cap,
-                     float **out_prob, float **out_avg)
-{
-    if (!path || !out_w || !out_h || !out_max_steps ||
-        !out_pU || !out_pD || !out_pL || !out_pR ||
-        !out_replications || !out_obstacle_mode || !out_obstacle_density ||
-        !out_obstacle_file || out_obstacle_file_cap == 0 ||
-        !out_sock || out_sock_cap == 0 ||
-        !out_prob || !out_avg) {
-        return 0;
+static const char *parse_float_fast(const char *p, const char *end, float *out) {
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    double v = 0.0;
+    int digits = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10.0 + (double)(*p++ - '0');
+        digits++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        double scale = 0.1;
+        while (p < end && *p >= '0' && *p <= '9') {
+            v += (double)(*p++ - '0') * scale;
+            scale *= 0.1;
+            digits++;
+        }
+    }
+    if (!digits) return NULL;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int e = 0;
+        const char *q = parse_int_fast(p + 1, end, &e);
+        if (q) {
+            p = q;
+            while (e > 0) { v *= 10.0; e--; }
+            while (e < 0) { v *= 0.1; e++; }
+        }
     }
+    *out = (float)(neg ? -v : v);
+    return p;
+}
 
-    FILE *fp = fopen(path, "r");
-    if (!fp) return 0;
+static void *parse_chunk(void *arg) {
+    ReplayChunk *c = (ReplayChunk*)arg;
+    const char *p = c->begin;
+    while (p < c->end) {
+        const char *eol = memchr(p, '\n', (size_t)(c->end - p));
+        if (!eol) eol = c->end;
 
-    char line[256];
-    if (!fgets(line, sizeof(line), fp)) {
-        fclose(fp);
-        return 0;
+        int x = 0, y = 0;
+        float pr = 0.0f, av = 0.0f;
+        const char *q = parse_int_fast(p, eol, &x);
+        if (q && q < eol && *q == ',') q = parse_int_fast(q + 1, eol, &y); else q = NULL;
+        if (q && q < eol && *q == ',') q = parse_float_fast(q + 1, eol, &pr); else q = NULL;
+        if (q && q < eol && *q == ',') q = parse_float_fast(q + 1, eol, &av); else q = NULL;
+        if (q && x >= 0 && x < c->w && y >= 0 && y < c->h) {
+            size_t idx = (size_t)y * (size_t)c->w + (size_t)x;
+            c->prob[idx] = pr;
+            c->avg[idx] = av;
+        }
+        p = eol + 1;
     }
+    return NULL;
+}
 
-    int w = 0, h = 0, k = 0, reps = 0, obstacles = 0;
-    float ob_density = 0.0f;
-    char ob_file[256] = {0};
-    char sock_buf[256] = {0};
-    float pU = 0.0f, pD = 0.0f, pL = 0.0f, pR = 0.0f;
-    char tmp[256];
-    strncpy(tmp, line, sizeof(tmp) - 1);
-    tmp[sizeof(tmp) - 1] = '\0';
-    tmp[strcspn(tmp, "\r\n")] = '\0';
+static void parse_body_parallel(const char *begin, const char *end, int w, int h,
+                                float *prob, float *avg) {
+    size_t len = (size_t)(end - begin);
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = (ncpu > 0) ? (int)ncpu : 1;
+    if (nthreads > REPLAY_MAX_THREADS) nthreads = REPLAY_MAX_THREADS;
+    if ((size_t)nthreads > len / REPLAY_MIN_CHUNK) nthreads = (int)(len / REPLAY_MIN_CHUNK);
+    if (nthreads < 1) nthreads = 1;
 
-    char *tokens[16] = {0};
-    int token_count = 0;
-    char *save = NULL;
-    for (char *tok = strtok_r(tmp, ",", &save);
-         tok && token_count < (int)(sizeof(tokens) / sizeof(tokens[0]));
-         tok = strtok_r(NULL, ",", &save)) {
-        tokens[token_count++] = tok;
+    ReplayChunk chunks[REPLAY_MAX_THREADS];
+    pthread_t th[REPLAY_MAX_THREADS];
+    int started[REPLAY_MAX_THREADS] = {0};
+    const char *p = begin;
+    for (int i = 0; i < nthreads; i++) {
+        const char *cend = (i == nthreads - 1) ? end : begin + len / (size_t)nthreads * (size_t)(i + 1);
+        if (cend < p) cend = p;
+        if (cend < end) {
+            const char *nl = memchr(cend, '\n', (size_t)(end - cend));
+            cend = nl ? nl + 1 : end;
+        }
+        chunks[i] = (ReplayChunk){ .begin = p, .end = cend, .w = w, .h = h, .prob = prob, .avg = avg };
+        p = cend;
     }
+    for (int i = 1; i < nthreads; i++) {
+        started[i] = (pthread_create(&th[i], NULL, parse_chunk, &chunks[i]) == 0);
+        if (!started[i]) parse_chunk(&chunks[i]);
+    }
+    parse_chunk(&chunks[0]);
+    for (int i = 1; i < nthreads; i++) {
+        if (started[i]) pthread_join(th[i], NULL);
+    }
+}
 
-    if (token_count < 7) {
-        fclose(fp);
-        return 0;
+static int load_binary(const char *path, ResultsMeta *m, float **out_prob, float **out_avg) {
+    ResultsFile rf;
+    if (!results_open(path, &rf)) return 0;
+    results_meta_from_header(rf.hdr, m);
+
+    size_t count = (size_t)m->world_w * (size_t)m->world_h;
+    float *prob = (float*)calloc(count, sizeof(float));
+    float *avg = (float*)calloc(count, sizeof(float));
+    if (!prob || !avg) {
+        free(prob);
+        free(avg);
+        results_close(&rf);
+        return -1;
     }
-    w = atoi(tokens[0]);
-    h = atoi(tokens[1]);
-    pU = strtof(tokens[2], NULL);
-    pD = strtof(tokens[3], NULL);
-    pL = strtof(tokens[4], NULL);
-    pR = strtof(tokens[5], NULL);
-    k = atoi(tokens[6]);
-    reps = (token_count > 7) ? atoi(tokens[7]) : 0;
-
-    int next = 8;
-    if (token_count > next) {
-        char *end = NULL;
-        long v = strtol(tokens[next], &end, 10);
-        if (end && *end == '\0') {
-            obstacles = (int)v;
-            next++;
-        } else {
-            snprintf(sock_buf, sizeof(sock_buf), "%s", tokens[next]);
-            next = token_count;
+    for (size_t t = 0; t < rf.tile_count; t++) {
+        const ResultsTileEntry *e = &rf.tiles[t];
+        const float *tp, *ta;
+        results_tile_columns(&rf, t, NULL, NULL, &tp, &ta);
+        for (uint32_t y = 0; y < e->h; y++) {
+            size_t dst = (size_t)(e->y0 + y) * (size_t)m->world_w + e->x0;
+            memcpy(prob + dst, tp + (size_t)y * e->w, e->w * sizeof(float));
+            memcpy(avg + dst, ta + (size_t)y * e->w, e->w * sizeof(float));
         }
     }
+    results_close(&rf);
+    *out_prob = prob;
+    *out_avg = avg;
+    return 1;
+}
 
-    if (token_count > next && token_is_number(tokens[next])) {
-        ob_density = strtof(tokens[next], NULL);
-        next++;
-        if (token_count > next && token_is_number(tokens[next])) {
-            next++;
-        }
-        if (token_count > next) {
-            snprintf(ob_file, sizeof(ob_file), "%s", tokens[next]);
-            next++;
-        }
-        if (token_count > next) {
-            snprintf(sock_buf, sizeof(sock_buf), "%s", tokens[next]);
-        }
-    } else if (token_count > next) {
-        snprintf(sock_buf, sizeof(sock_buf), "%s", tokens[next]);
+static int load_csv(const char *path, ResultsMeta *m, float **out_prob, float **out_avg) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return 0;
     }
-    if (w <= 0 || h <= 0) {
-        fclose(fp);
+    size_t len = (size_t)st.st_size;
+    const char *data = (const char*)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 0;
+    madvise((void*)data, len, MADV_SEQUENTIAL);
+
+    const char *end = data + len;
+    const char *eol = memchr(data, '\n', len);
+    if (!eol) eol = end;
+    size_t hlen = (size_t)(eol - data);
+    char *header = (char*)malloc(hlen + 1u);
+    if (!header) {
+        munmap((void*)data, len);
+        return 0;
+    }
+    memcpy(header, data, hlen);
+    header[hlen] = '\0';
+    header[strcspn(header, "\r")] = '\0';
+    int ok = results_parse_csv_header(header, m);
+    free(header);
+    if (!ok) {
+        munmap((void*)data, len);
         return 0;
     }
 
-    size_t count = (size_t)w * (size_t)h;
+    size_t count = (size_t)m->world_w * (size_t)m->world_h;
     float *prob = (float*)calloc(count, sizeof(float));
     float *avg = (float*)calloc(count, sizeof(float));
     if (!prob || !avg) {
         free(prob);
         free(avg);
-        fclose(fp);
+        munmap((void*)data, len);
         return 0;
     }
 
-    while (fgets(line, sizeof(line), fp)) {
-        int x = 0, y = 0;
-        float pr = 0.0f, av = 0.0f;
-        if (sscanf(line, "%d,%d,%f,%f", &x, &y, &pr, &av) == 4) {
-            if (x >= 0 && x < w && y >= 0 && y < h) {
-                size_t idx = (size_t)y * (size_t)w + (size_t)x;
-                prob[idx] = pr;
-                avg[idx] = av;
-            }
-        }
+    if (eol < end) {
+        parse_body_parallel(eol + 1, end, m->world_w, m->world_h, prob, avg);
+    }
+    munmap((void*)data, len);
+    *out_prob = prob;
+    *out_avg = avg;
+    return 1;
+}
+
+int load_replay_file(const char *path, int *out_w, int *out_h, int *out_max_steps,
+                     float *out_pU, float *out_pD, float *out_pL, float *out_pR,
+                     int *out_replications, int *out_obstacle_mode,
+                     float *out_obstacle_density,
+                     char *out_obstacle_file, size_t out_obstacle_file_cap,
+                     char *out_sock, size_t out_sock_cap,
+                     float **out_prob, float **out_avg)
+{
+    if (!path || !out_w || !out_h || !out_max_steps ||
+        !out_pU || !out_pD || !out_pL || !out_pR ||
+        !out_replications || !out_obstacle_mode || !out_obstacle_density ||
+        !out_obstacle_file || out_obstacle_file_cap == 0 ||
+        !out_sock || out_sock_cap == 0 ||
+        !out_prob || !out_avg) {
+        return 0;
+    }
+
+    ResultsMeta m;
+    memset(&m, 0, sizeof(m));
+    float *prob = NULL;
+    float *avg = NULL;
+    int rc = load_binary(path, &m, &prob, &avg);
+    if (rc < 0) return 0;
+    if (rc == 0) {
+        memset(&m, 0, sizeof(m));
+        if (!load_csv(path, &m, &prob, &avg)) return 0;
     }
 
-    fclose(fp);
-    *out_w = w;
-    *out_h = h;
-    *out_max_steps = k;
-    *out_pU = pU;
-    *out_pD = pD;
-    *out_pL = pL;
-    *out_pR = pR;
-    *out_replications = reps;
-    *out_obstacle_mode = obstacles;
-    *out_obstacle_density = ob_density;
-    if (strcmp(ob_file, "-") != 0 && ob_file[0] != '\0') {
-        copy_path(out_obstacle_file, out_obstacle_file_cap, ob_file);
+    *out_w = m.world_w;
+    *out_h = m.world_h;
+    *out_max_steps = m.max_steps;
+    *out_pU = m.pU;
+    *out_pD = m.pD;
+    *out_pL = m.pL;
+    *out_pR = m.pR;
+    *out_replications = m.replications;
+    *out_obstacle_mode = m.obstacle_mode;
+    *out_obstacle_density = m.obstacle_density;
+    if (strcmp(m.obstacle_file, "-") != 0 && m.obstacle_file[0] != '\0') {
+        copy_path(out_obstacle_file, out_obstacle_file_cap, m.obstacle_file);
     } else {
         out_obstacle_file[0] = '\0';
     }
-    if (sock_buf[0] != '\0') {
-        copy_path(out_sock, out_sock_cap, sock_buf);
+    if (m.sock_path[0] != '\0') {
+        copy_path(out_sock, out_sock_cap, m.sock_path);
     } else {
         out_sock[0] = '\0';
     }
@@ -2,20 +2,78 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/types.h>
 
+static int wait_ready(int fd) {
+    char line[256];
+    size_t len = 0;
+    while (len < sizeof(line) - 1) {
+        struct pollfd p = { .fd = fd, .events = POLLIN };
+        int pr = poll(&p, 1, SPAWN_READY_TIMEOUT_MS);
+        if (pr < 0 && errno == EINTR) continue;
+        if (pr <= 0) return 0;
+        ssize_t r = read(fd, line + len, sizeof(line) - 1 - len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return 0;
+        len += (size_t)r;
+        line[len] = '\0';
+        if (strchr(line, '\n')) break;
+    }
+    return strncmp(line, "SERVER READY", 12) == 0;
+}
+
+static pid_t fork_server(int ready[2]) {
+    if (pipe(ready) != 0) return -1;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(ready[0]);
+        close(ready[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        (void)setsid();
+        close(ready[0]);
+        char fdbuf[16], idlebuf[16];
+        snprintf(fdbuf, sizeof(fdbuf), "%d", ready[1]);
+        snprintf(idlebuf, sizeof(idlebuf), "%d", SPAWN_IDLE_SECS);
+        setenv("RW_READY_FD", fdbuf, 1);
+        setenv("RW_IDLE_SECS", idlebuf, 0);
+        return 0;
+    }
+    close(ready[1]);
+    return pid;
+}
+
+int spawn_host(const char *server_path, const char *sock_path) {
+    int ready[2];
+    pid_t pid = fork_server(ready);
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        execl(server_path, server_path, "--sessions", sock_path, (char*)NULL);
+        perror("execl server");
+        _exit(127);
+    }
+    int ok = wait_ready(ready[0]);
+    close(ready[0]);
+    return ok ? 0 : -1;
+}
+
 int spawn_server(const char *server_path, const char *sock_path,
                  int world_w, int world_h, int delay_ms, int replications, int max_steps,
                  float pU, float pD, float pL, float pR, const char *output_path,
                  int base_replications, int obstacle_mode, float obstacle_density,
                  const char *obstacle_file,
-                 int start_on_client)
+                 int start_on_client, const char *base_file)
 {
-    pid_t pid = fork();
+    int ready[2];
+    pid_t pid = fork_server(ready);
     if (pid < 0) return -1;
     if (pid == 0) {
-        (void)setsid();
         char wbuf[32], hbuf[32], dbuf[32], rbuf[32], kbuf[32], pu[32], pd[32], pl[32], pr[32];
         char basebuf[32], obbuf[32], obdens[32], startbuf[32];
         snprintf(wbuf, sizeof(wbuf), "%d", world_w);
@@ -35,13 +93,15 @@ int spawn_server(const char *server_path, const char *sock_path,
         if (output_path && output_path[0]) {
             execl(server_path, server_path, sock_path, wbuf, hbuf, dbuf, rbuf, kbuf,
                   pu, pd, pl, pr, output_path, basebuf, obbuf, obdens,
-                  obstacle_file ? obstacle_file : "", startbuf, (char*)NULL);
+                  obstacle_file ? obstacle_file : "", startbuf,
+                  base_file ? base_file : "", (char*)NULL);
         } else {
             execl(server_path, server_path, sock_path, wbuf, hbuf, dbuf, rbuf, kbuf, pu, pd, pl, pr, (char*)NULL);
         }
         perror("execl server");
         _exit(127);
     }
-    usleep(150 * 1000);
-    return 0;
+    int ok = wait_ready(ready[0]);
+    close(ready[0]);
+    return ok ? 0 : -1;
 }
@@ -2,9 +2,14 @@
 
 #include <stdint.h>
 
+#define SPAWN_READY_TIMEOUT_MS 10000
+#define SPAWN_IDLE_SECS 60
+#define SPAWN_PROBE_MS 500
+
+int spawn_host(const char *server_path, const char *sock_path);
 int spawn_server(const char *server_path, const char *sock_path,
                  int world_w, int world_h, int delay_ms, int replications, int max_steps,
                  float pU, float pD, float pL, float pR, const char *output_path,
                  int base_replications, int obstacle_mode, float obstacle_density,
                  const char *obstacle_file,
-                 int start_on_client);
+                 int start_on_client, const char *base_file);
@@ -69,8 +69,11 @@ typedef struct {
     int allow_dot;
 } InputField;
 
+typedef struct LocalEngine LocalEngine;
+
 typedef struct {
     int sockfd;
+    LocalEngine *local;
     atomic_int running;
 
     atomic_int have_welcome;
@@ -98,6 +101,7 @@ typedef struct {
     int stats_w, stats_h;
     int have_stats;
     int stats_dirty;
+    float precision;
     SDL_Texture *stats_tex;
     int show_stats_numbers;
     int show_avg_steps;
@@ -0,0 +1,508 @@
+#include "results_io.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CELL_BYTES (sizeof(uint64_t) + sizeof(uint32_t) + 2u * sizeof(float))
+#define SINK_MAX_OP (1u << 30)
+
+static int use_uring;
+
+static size_t tile_bytes(uint32_t w, uint32_t h) {
+    size_t bytes = (size_t)w * (size_t)h * CELL_BYTES;
+    return (bytes + 7u) & ~(size_t)7u;
+}
+
+static int finish_tmp(FILE *fp, const char *tmp, const char *path) {
+    int ok = (fflush(fp) == 0) && (fsync(fileno(fp)) == 0);
+    if (fclose(fp) != 0) ok = 0;
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+void results_io_use_uring(int on) {
+    use_uring = on;
+}
+
+int sink_open(FileSink *s, const char *path) {
+    memset(s, 0, sizeof(*s));
+    snprintf(s->tmp, sizeof(s->tmp), "%s.tmp", path);
+    s->fd = open(s->tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (s->fd < 0) return 0;
+    s->use_ring = use_uring && uring_init(&s->ring, SINK_OPS);
+    return 1;
+}
+
+static void sink_queue(FileSink *s, int i) {
+    struct io_uring_sqe *sqe = uring_sqe(&s->ring);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = s->fd;
+    sqe->addr = (uint64_t)(uintptr_t)s->ops[i].p;
+    sqe->len = (s->ops[i].n > SINK_MAX_OP) ? SINK_MAX_OP : (uint32_t)s->ops[i].n;
+    sqe->off = s->ops[i].off;
+    sqe->user_data = (uint64_t)i;
+    s->inflight++;
+}
+
+// Submits what is queued and retires one write; a short one is queued
+// again for the rest.
+static void sink_complete(FileSink *s) {
+    struct io_uring_cqe cqe;
+    while (!uring_reap(&s->ring, &cqe)) {
+        if (uring_submit(&s->ring, 1, -1) != 0) {
+            s->failed = 1;
+            s->inflight = 0;
+            return;
+        }
+    }
+    int i = (int)cqe.user_data;
+    s->inflight--;
+    if (cqe.res > 0 && (size_t)cqe.res < s->ops[i].n) {
+        s->ops[i].p += cqe.res;
+        s->ops[i].n -= (size_t)cqe.res;
+        s->ops[i].off += (uint64_t)cqe.res;
+        sink_queue(s, i);
+        return;
+    }
+    if (cqe.res <= 0) s->failed = 1;
+    if (s->ops[i].buf >= 0) s->buf_busy[s->ops[i].buf] = 0;
+    s->op_busy &= ~(1u << i);
+}
+
+uint8_t *sink_buffer(FileSink *s, size_t bytes) {
+    int nbufs = s->use_ring ? SINK_BUFS : 1;
+    if (bytes > s->buf_cap) {
+        while (s->inflight && !s->failed) sink_complete(s);
+        for (int b = 0; b < nbufs; b++) {
+            free(s->buf[b]);
+            s->buf[b] = (uint8_t*)calloc(bytes, 1);
+            s->buf_busy[b] = 0;
+            if (!s->buf[b]) s->failed = 1;
+        }
+        s->buf_cap = bytes;
+    }
+    int b = s->buf_next;
+    while (s->buf_busy[b] && !s->failed) sink_complete(s);
+    if (s->failed) return NULL;
+    s->buf_next = (b + 1) % nbufs;
+    return s->buf[b];
+}
+
+int sink_write(FileSink *s, const void *p, size_t n, uint64_t off) {
+    const uint8_t *src = (const uint8_t*)p;
+    if (s->failed || n == 0) return !s->failed;
+    if (!s->use_ring) {
+        while (n) {
+            ssize_t w = pwrite(s->fd, src, n, (off_t)off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                s->failed = 1;
+                return 0;
+            }
+            src += w;
+            n -= (size_t)w;
+            off += (uint64_t)w;
+        }
+        return 1;
+    }
+    while (s->op_busy == (1u << SINK_OPS) - 1u && !s->failed) sink_complete(s);
+    if (s->failed) return 0;
+    int i = 0;
+    while (s->op_busy & (1u << i)) i++;
+    s->op_busy |= 1u << i;
+    s->ops[i].p = src;
+    s->ops[i].n = n;
+    s->ops[i].off = off;
+    s->ops[i].buf = -1;
+    for (int b = 0; b < SINK_BUFS; b++) {
+        if (s->buf[b] && src >= s->buf[b] && src < s->buf[b] + s->buf_cap) {
+            s->ops[i].buf = b;
+            s->buf_busy[b] = 1;
+        }
+    }
+    sink_queue(s, i);
+    return 1;
+}
+
+// A NULL path discards the file.
+int sink_commit(FileSink *s, const char *path) {
+    if (s->use_ring) {
+        while (s->inflight && !s->failed) sink_complete(s);
+        uring_free(&s->ring);
+    }
+    int ok = path && !s->failed && fsync(s->fd) == 0;
+    if (close(s->fd) != 0) ok = 0;
+    if (ok && rename(s->tmp, path) != 0) ok = 0;
+    if (!ok) unlink(s->tmp);
+    for (int b = 0; b < SINK_BUFS; b++) free(s->buf[b]);
+    return ok;
+}
+
+int results_is_csv_path(const char *path) {
+    size_t len = path ? strlen(path) : 0;
+    return len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+}
+
+int results_write_binary(const char *path, const ResultsMeta *m,
+                         const uint32_t *hits, const uint64_t *steps) {
+    FileSink sink;
+    if (!sink_open(&sink, path)) return 0;
+
+    ResultsHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RESULTS_MAGIC, sizeof(h.magic));
+    h.version = RESULTS_VERSION;
+    h.header_size = (uint32_t)sizeof(h);
+    h.world_w = (uint32_t)m->world_w;
+    h.world_h = (uint32_t)m->world_h;
+    h.pU = m->pU; h.pD = m->pD; h.pL = m->pL; h.pR = m->pR;
+    h.max_steps = (uint32_t)m->max_steps;
+    h.replications = (uint32_t)m->replications;
+    h.obstacle_mode = (uint32_t)m->obstacle_mode;
+    h.obstacle_density = m->obstacle_density;
+    h.tile_w = RESULTS_TILE;
+    h.tile_h = RESULTS_TILE;
+    h.tiles_x = (h.world_w + RESULTS_TILE - 1u) / RESULTS_TILE;
+    h.tiles_y = (h.world_h + RESULTS_TILE - 1u) / RESULTS_TILE;
+    snprintf(h.obstacle_file, sizeof(h.obstacle_file), "%s", m->obstacle_file);
+    snprintf(h.sock_path, sizeof(h.sock_path), "%s", m->sock_path);
+
+    size_t tile_count = (size_t)h.tiles_x * (size_t)h.tiles_y;
+    ResultsTileEntry *index = (ResultsTileEntry*)calloc(tile_count, sizeof(*index));
+    if (!index) {
+        sink_commit(&sink, NULL);
+        return 0;
+    }
+
+    // The header goes in last, once the index offset is known.
+    uint64_t off = (sizeof(h) + 7u) & ~(uint64_t)7u;
+    int ok = 1;
+
+    size_t t = 0;
+    for (uint32_t ty = 0; ok && ty < h.tiles_y; ty++) {
+        for (uint32_t tx = 0; ok && tx < h.tiles_x; tx++, t++) {
+            uint32_t x0 = tx * RESULTS_TILE, y0 = ty * RESULTS_TILE;
+            uint32_t tw = (x0 + RESULTS_TILE <= h.world_w) ? RESULTS_TILE : h.world_w - x0;
+            uint32_t th = (y0 + RESULTS_TILE <= h.world_h) ? RESULTS_TILE : h.world_h - y0;
+            size_t n = (size_t)tw * (size_t)th;
+            uint8_t *buf = sink_buffer(&sink, tile_bytes(RESULTS_TILE, RESULTS_TILE));
+            if (!buf) {
+                ok = 0;
+                break;
+            }
+            uint64_t *c_steps = (uint64_t*)buf;
+            uint32_t *c_hits = (uint32_t*)(c_steps + n);
+            float *c_prob = (float*)(c_hits + n);
+            float *c_avg = c_prob + n;
+            for (uint32_t y = 0; y < th; y++) {
+                for (uint32_t x = 0; x < tw; x++) {
+                    size_t src = (size_t)(y0 + y) * h.world_w + (x0 + x);
+                    size_t dst = (size_t)y * tw + x;
+                    c_hits[dst] = hits[src];
+                    c_steps[dst] = steps[src];
+                    c_prob[dst] = (m->replications > 0)
+                        ? (float)((double)hits[src] / (double)m->replications) : 0.0f;
+                    c_avg[dst] = hits[src] ? (float)((double)steps[src] / (double)hits[src]) : 0.0f;
+                }
+            }
+            size_t bytes = tile_bytes(tw, th);
+            memset(buf + n * CELL_BYTES, 0, bytes - n * CELL_BYTES);
+            index[t] = (ResultsTileEntry){ .offset = off, .x0 = x0, .y0 = y0, .w = tw, .h = th };
+            ok = sink_write(&sink, buf, bytes, off);
+            off += bytes;
+        }
+    }
+
+    uint8_t head[(sizeof(h) + 7u) & ~(size_t)7u];
+    memset(head, 0, sizeof(head));
+    h.index_offset = off;
+    memcpy(head, &h, sizeof(h));
+    if (ok) ok = sink_write(&sink, index, tile_count * sizeof(*index), off);
+    if (ok) ok = sink_write(&sink, head, sizeof(head), 0);
+    ok = sink_commit(&sink, ok ? path : NULL);
+    free(index);
+    return ok;
+}
+
+int results_write_csv(const char *path, const ResultsMeta *m,
+                      const uint32_t *hits, const uint64_t *steps) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return 0;
+
+    const char *ob_file = (m->obstacle_file[0] != '\0') ? m->obstacle_file : "-";
+    fprintf(fp, "%d,%d,%.6f,%.6f,%.6f,%.6f,%d,%d,%d,%.6f,%s,%s\n",
+            m->world_w, m->world_h, m->pU, m->pD, m->pL, m->pR,
+            m->max_steps, m->replications,
+            m->obstacle_mode, m->obstacle_density,
+            ob_file, m->sock_path);
+
+    for (int y = 0; y < m->world_h; y++) {
+        for (int x = 0; x < m->world_w; x++) {
+            size_t idx = (size_t)y * (size_t)m->world_w + (size_t)x;
+            if (!hits[idx] || m->replications <= 0) continue;
+            float prob = (float)((double)hits[idx] / (double)m->replications);
+            float avg = (float)((double)steps[idx] / (double)hits[idx]);
+            fprintf(fp, "%d,%d,%.6f,%.6f,%u,%llu\n", x, y, prob, avg,
+                    hits[idx], (unsigned long long)steps[idx]);
+        }
+    }
+    return finish_tmp(fp, tmp, path);
+}
+
+static int token_is_number(const char *s) {
+    if (!s || *s == '\0') return 0;
+    char *end = NULL;
+    strtof(s, &end);
+    return end && *end == '\0';
+}
+
+int results_parse_csv_header(char *line, ResultsMeta *m) {
+    char *tokens[16] = {0};
+    int token_count = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, ",", &save);
+         tok && token_count < (int)(sizeof(tokens) / sizeof(tokens[0]));
+         tok = strtok_r(NULL, ",", &save)) {
+        tokens[token_count++] = tok;
+    }
+
+    if (token_count < 7) return 0;
+    m->world_w = atoi(tokens[0]);
+    m->world_h = atoi(tokens[1]);
+    m->pU = strtof(tokens[2], NULL);
+    m->pD = strtof(tokens[3], NULL);
+    m->pL = strtof(tokens[4], NULL);
+    m->pR = strtof(tokens[5], NULL);
+    m->max_steps = atoi(tokens[6]);
+    m->replications = (token_count > 7) ? atoi(tokens[7]) : 0;
+
+    int next = 8;
+    if (token_count > next) {
+        char *end = NULL;
+        long v = strtol(tokens[next], &end, 10);
+        if (end && *end == '\0') {
+            m->obstacle_mode = (int)v;
+            next++;
+        } else {
+            snprintf(m->sock_path, sizeof(m->sock_path), "%s", tokens[next]);
+            next = token_count;
+        }
+    }
+
+    if (token_count > next && token_is_number(tokens[next])) {
+        m->obstacle_density = strtof(tokens[next], NULL);
+        next++;
+        if (token_count > next && token_is_number(tokens[next])) {
+            next++;
+        }
+        if (token_count > next) {
+            if (strcmp(tokens[next], "-") != 0) {
+                snprintf(m->obstacle_file, sizeof(m->obstacle_file), "%s", tokens[next]);
+            }
+            next++;
+        }
+        if (token_count > next) {
+            snprintf(m->sock_path, sizeof(m->sock_path), "%s", tokens[next]);
+        }
+    } else if (token_count > next) {
+        snprintf(m->sock_path, sizeof(m->sock_path), "%s", tokens[next]);
+    }
+    return m->world_w > 0 && m->world_h > 0;
+}
+
+static int load_csv_counts(const char *path, ResultsMeta *m, uint32_t **out_hits, uint64_t **out_steps) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n = getline(&line, &cap, fp);
+    if (n <= 0) {
+        free(line);
+        fclose(fp);
+        return 0;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    memset(m, 0, sizeof(*m));
+    if (!results_parse_csv_header(line, m)) {
+        free(line);
+        fclose(fp);
+        return 0;
+    }
+
+    size_t count = (size_t)m->world_w * (size_t)m->world_h;
+    uint32_t *hits = (uint32_t*)calloc(count, sizeof(*hits));
+    uint64_t *steps = (uint64_t*)calloc(count, sizeof(*steps));
+    if (!hits || !steps) {
+        free(hits);
+        free(steps);
+        free(line);
+        fclose(fp);
+        return 0;
+    }
+
+    while (getline(&line, &cap, fp) > 0) {
+        char *p = line, *end = NULL;
+        long x = strtol(p, &end, 10);
+        if (end == p || *end != ',') continue;
+        long y = strtol(p = end + 1, &end, 10);
+        if (end == p || *end != ',') continue;
+        double prob = strtod(p = end + 1, &end);
+        if (end == p || *end != ',') continue;
+        double avg = strtod(p = end + 1, &end);
+        if (end == p) continue;
+        if (x < 0 || x >= m->world_w || y < 0 || y >= m->world_h) continue;
+
+        size_t idx = (size_t)y * (size_t)m->world_w + (size_t)x;
+        if (*end == ',') {
+            hits[idx] = (uint32_t)strtoul(end + 1, &end, 10);
+            if (*end == ',') {
+                steps[idx] = (uint64_t)strtoull(end + 1, &end, 10);
+                continue;
+            }
+        } else {
+            hits[idx] = (uint32_t)(prob * (double)m->replications + 0.5);
+        }
+        steps[idx] = (uint64_t)(avg * (double)hits[idx] + 0.5);
+    }
+
+    free(line);
+    fclose(fp);
+    *out_hits = hits;
+    *out_steps = steps;
+    return 1;
+}
+
+// CSV headers keep six decimals, so the probabilities and the density are
+// compared at that precision.
+static int same_float(float a, float b) {
+    float d = a - b;
+    return d <= 1e-6f && d >= -1e-6f;
+}
+
+int results_same_config(const ResultsMeta *a, const ResultsMeta *b) {
+    return a->world_w == b->world_w && a->world_h == b->world_h &&
+           same_float(a->pU, b->pU) && same_float(a->pD, b->pD) &&
+           same_float(a->pL, b->pL) && same_float(a->pR, b->pR) &&
+           a->max_steps == b->max_steps && a->obstacle_mode == b->obstacle_mode &&
+           same_float(a->obstacle_density, b->obstacle_density) &&
+           strcmp(a->obstacle_file, b->obstacle_file) == 0;
+}
+
+int results_load_counts(const char *path, ResultsMeta *m, uint32_t **out_hits, uint64_t **out_steps) {
+    ResultsFile rf;
+    if (!results_open(path, &rf)) {
+        return load_csv_counts(path, m, out_hits, out_steps);
+    }
+
+    results_meta_from_header(rf.hdr, m);
+    size_t count = (size_t)m->world_w * (size_t)m->world_h;
+    uint32_t *hits = (uint32_t*)calloc(count, sizeof(*hits));
+    uint64_t *steps = (uint64_t*)calloc(count, sizeof(*steps));
+    if (!hits || !steps) {
+        free(hits);
+        free(steps);
+        results_close(&rf);
+        return 0;
+    }
+    for (size_t t = 0; t < rf.tile_count; t++) {
+        const ResultsTileEntry *e = &rf.tiles[t];
+        const uint64_t *ts;
+        const uint32_t *th;
+        results_tile_columns(&rf, t, &ts, &th, NULL, NULL);
+        for (uint32_t y = 0; y < e->h; y++) {
+            size_t dst = (size_t)(e->y0 + y) * (size_t)m->world_w + e->x0;
+            memcpy(hits + dst, th + (size_t)y * e->w, e->w * sizeof(*hits));
+            memcpy(steps + dst, ts + (size_t)y * e->w, e->w * sizeof(*steps));
+        }
+    }
+    results_close(&rf);
+    *out_hits = hits;
+    *out_steps = steps;
+    return 1;
+}
+
+int results_open(const char *path, ResultsFile *rf) {
+    memset(rf, 0, sizeof(*rf));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ResultsHeader)) {
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    const ResultsHeader *h = (const ResultsHeader*)map;
+    size_t len = (size_t)st.st_size;
+    size_t tile_count = (size_t)h->tiles_x * (size_t)h->tiles_y;
+    if (memcmp(h->magic, RESULTS_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != RESULTS_VERSION || h->header_size != sizeof(*h) ||
+        h->world_w == 0 || h->world_h == 0 ||
+        h->index_offset > len ||
+        tile_count > (len - h->index_offset) / sizeof(ResultsTileEntry)) {
+        munmap(map, len);
+        return 0;
+    }
+    const ResultsTileEntry *tiles = (const ResultsTileEntry*)((const uint8_t*)map + h->index_offset);
+    for (size_t t = 0; t < tile_count; t++) {
+        if (tiles[t].x0 + tiles[t].w > h->world_w || tiles[t].y0 + tiles[t].h > h->world_h ||
+            tiles[t].offset > len || tile_bytes(tiles[t].w, tiles[t].h) > len - tiles[t].offset) {
+            munmap(map, len);
+            return 0;
+        }
+    }
+
+    rf->map = map;
+    rf->map_len = len;
+    rf->hdr = h;
+    rf->tiles = tiles;
+    rf->tile_count = tile_count;
+    return 1;
+}
+
+void results_close(ResultsFile *rf) {
+    if (rf->map) munmap(rf->map, rf->map_len);
+    memset(rf, 0, sizeof(*rf));
+}
+
+void results_meta_from_header(const ResultsHeader *h, ResultsMeta *m) {
+    memset(m, 0, sizeof(*m));
+    m->world_w = (int)h->world_w;
+    m->world_h = (int)h->world_h;
+    m->pU = h->pU; m->pD = h->pD; m->pL = h->pL; m->pR = h->pR;
+    m->max_steps = (int)h->max_steps;
+    m->replications = (int)h->replications;
+    m->obstacle_mode = (int)h->obstacle_mode;
+    m->obstacle_density = h->obstacle_density;
+    snprintf(m->obstacle_file, sizeof(m->obstacle_file), "%.*s",
+             (int)sizeof(h->obstacle_file), h->obstacle_file);
+    snprintf(m->sock_path, sizeof(m->sock_path), "%.*s",
+             (int)sizeof(h->sock_path), h->sock_path);
+}
+
+void results_tile_columns(const ResultsFile *rf, size_t tile,
+                          const uint64_t **steps, const uint32_t **hits,
+                          const float **prob, const float **avg) {
+    const ResultsTileEntry *e = &rf->tiles[tile];
+    size_t n = (size_t)e->w * (size_t)e->h;
+    const uint8_t *base = (const uint8_t*)rf->map + e->offset;
+    const uint64_t *s = (const uint64_t*)base;
+    const uint32_t *c = (const uint32_t*)(s + n);
+    const float *p = (const float*)(c + n);
+    if (steps) *steps = s;
+    if (hits) *hits = c;
+    if (prob) *prob = p;
+    if (avg) *avg = p + n;
+}
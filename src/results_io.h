@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uring.h"
+
+#define RESULTS_MAGIC "RWRES\0\0\0"
+#define RESULTS_VERSION 1
+#define RESULTS_TILE 64
+
+typedef struct {
+    int world_w, world_h;
+    float pU, pD, pL, pR;
+    int max_steps;
+    int replications;
+    int obstacle_mode;
+    float obstacle_density;
+    char obstacle_file[256];
+    char sock_path[108];
+} ResultsMeta;
+
+#pragma pack(push, 1)
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t world_w;
+    uint32_t world_h;
+    float pU, pD, pL, pR;
+    uint32_t max_steps;
+    uint32_t replications;
+    uint32_t obstacle_mode;
+    float obstacle_density;
+    uint32_t tile_w;
+    uint32_t tile_h;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint64_t index_offset;
+    char obstacle_file[256];
+    char sock_path[108];
+    uint32_t reserved;
+} ResultsHeader;
+
+// Each tile holds tw*th cells in row-major order, stored as four columns:
+// uint64 step sums, uint32 hit counts, float prob, float avg steps.
+typedef struct {
+    uint64_t offset;
+    uint32_t x0, y0;
+    uint32_t w, h;
+} ResultsTileEntry;
+#pragma pack(pop)
+
+typedef struct {
+    void *map;
+    size_t map_len;
+    const ResultsHeader *hdr;
+    const ResultsTileEntry *tiles;
+    size_t tile_count;
+} ResultsFile;
+
+#define SINK_BUFS 4
+#define SINK_OPS 16
+
+// Positional writes to path.tmp, renamed over path on commit. With io_uring
+// on, writes are queued on a private ring and only reaped when a buffer or
+// op slot is needed again; memory passed to sink_write must stay valid
+// until then. Otherwise every write is a plain pwrite.
+typedef struct {
+    int fd;
+    char tmp[512];
+    int failed;
+    int use_ring;
+    Uring ring;
+    unsigned inflight;
+    struct { const uint8_t *p; size_t n; uint64_t off; int buf; } ops[SINK_OPS];
+    uint32_t op_busy;
+    uint8_t *buf[SINK_BUFS];
+    size_t buf_cap;
+    int buf_busy[SINK_BUFS];
+    int buf_next;
+} FileSink;
+
+void results_io_use_uring(int on);
+int sink_open(FileSink *s, const char *path);
+uint8_t *sink_buffer(FileSink *s, size_t bytes);
+int sink_write(FileSink *s, const void *p, size_t n, uint64_t off);
+int sink_commit(FileSink *s, const char *path);
+
+int results_write_binary(const char *path, const ResultsMeta *m,
+                         const uint32_t *hits, const uint64_t *steps);
+int results_write_csv(const char *path, const ResultsMeta *m,
+                      const uint32_t *hits, const uint64_t *steps);
+int results_is_csv_path(const char *path);
+
+int results_parse_csv_header(char *line, ResultsMeta *m);
+int results_same_config(const ResultsMeta *a, const ResultsMeta *b);
+int results_load_counts(const char *path, ResultsMeta *m, uint32_t **out_hits, uint64_t **out_steps);
+
+int results_open(const char *path, ResultsFile *rf);
+void results_close(ResultsFile *rf);
+void results_meta_from_header(const ResultsHeader *h, ResultsMeta *m);
+void results_tile_columns(const ResultsFile *rf, size_t tile,
+                          const uint64_t **steps, const uint32_t **hits,
+                          const float **prob, const float **avg);
@@ -0,0 +1,210 @@
+#include "rwalk.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct RwWorld {
+    int w, h;
+    int max_steps;
+    float pU, pD, pL, pR;
+    // Cumulative thresholds, as floats for the reference kernel and on the
+    // 24-bit integer draw behind rng_float for the fast one.
+    float cUD, cUDL;
+    uint32_t tU, tUD, tUDL;
+    const uint8_t *obstacles;
+    uint32_t *hits;
+    uint64_t *steps;
+    int replications;
+    uint64_t seed;
+    uint64_t runs;
+};
+
+typedef struct {
+    RwWorld *W;
+    int replications;
+    RwKernel kernel;
+    uint64_t run_seed;
+    atomic_int next_row;
+} RunShared;
+
+// Smallest integer draw v with v / 2^24 >= c, so v < t matches rng_float() < c.
+static uint32_t draw_threshold(float c) {
+    double t = ceil((double)c * 16777216.0);
+    if (t < 0.0) return 0;
+    if (t > 4294967295.0) return UINT32_MAX;
+    return (uint32_t)t;
+}
+
+RwWorld *rwalk_world_create(int w, int h, int max_steps, float pU, float pD, float pL, float pR) {
+    if (w <= 0 || h <= 0 || max_steps <= 0) return NULL;
+    if (pU < 0.0f || pD < 0.0f || pL < 0.0f || pR < 0.0f) return NULL;
+    RwWorld *W = (RwWorld*)calloc(1, sizeof(*W));
+    if (!W) return NULL;
+    W->w = w;
+    W->h = h;
+    W->max_steps = max_steps;
+    W->pU = pU; W->pD = pD; W->pL = pL; W->pR = pR;
+    W->cUD = pU + pD;
+    W->cUDL = pU + pD + pL;
+    W->tU = draw_threshold(pU);
+    W->tUD = draw_threshold(W->cUD);
+    W->tUDL = draw_threshold(W->cUDL);
+    return W;
+}
+
+void rwalk_world_free(RwWorld *W) {
+    if (!W) return;
+    free(W->hits);
+    free(W->steps);
+    free(W);
+}
+
+void rwalk_world_set_obstacles(RwWorld *W, const uint8_t *obstacles) {
+    W->obstacles = obstacles;
+}
+
+void rwalk_world_seed(RwWorld *W, uint64_t seed) {
+    W->seed = seed;
+    W->runs = 0;
+}
+
+void rwalk_world_reset(RwWorld *W) {
+    size_t count = (size_t)W->w * (size_t)W->h;
+    if (W->hits) memset(W->hits, 0, count * sizeof(*W->hits));
+    if (W->steps) memset(W->steps, 0, count * sizeof(*W->steps));
+    W->replications = 0;
+}
+
+int rwalk_width(const RwWorld *W) { return W->w; }
+int rwalk_height(const RwWorld *W) { return W->h; }
+int rwalk_replications(const RwWorld *W) { return W->replications; }
+const uint32_t *rwalk_hits(const RwWorld *W) { return W->hits; }
+const uint64_t *rwalk_steps(const RwWorld *W) { return W->steps; }
+
+int rwalk_step(const RwWorld *W, Rng *r, int *x, int *y) {
+    float v = rng_float(r);
+    int dx = 0, dy = 0, dir;
+
+    if (v < W->pU) { dy = -1; dir = RW_DIR_UP; }
+    else if (v < W->cUD) { dy = +1; dir = RW_DIR_DOWN; }
+    else if (v < W->cUDL) { dx = -1; dir = RW_DIR_LEFT; }
+    else { dx = +1; dir = RW_DIR_RIGHT; }
+
+    int nx = (*x + dx) % W->w;
+    int ny = (*y + dy) % W->h;
+    if (nx < 0) nx += W->w;
+    if (ny < 0) ny += W->h;
+    if (!W->obstacles || !W->obstacles[(size_t)ny * (size_t)W->w + (size_t)nx]) {
+        *x = nx;
+        *y = ny;
+    }
+    return dir;
+}
+
+static int walk_reference(const RwWorld *W, Rng *r, int x, int y, int *out_steps) {
+    int cx = W->w / 2, cy = W->h / 2;
+    for (int step = 0; step < W->max_steps; step++) {
+        rwalk_step(W, r, &x, &y);
+        if (x == cx && y == cy) {
+            *out_steps = step;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int walk_fast(const RwWorld *W, Rng *r, int x, int y, int *out_steps) {
+    const int w = W->w, h = W->h;
+    const int cx = w / 2, cy = h / 2;
+    const uint8_t *obs = W->obstacles;
+    const uint32_t tU = W->tU, tUD = W->tUD, tUDL = W->tUDL;
+    for (int step = 0; step < W->max_steps; step++) {
+        uint32_t v = (uint32_t)(rng_next(r) >> 40);
+        int nx = x, ny = y;
+        if (v < tU) ny = (y == 0) ? h - 1 : y - 1;
+        else if (v < tUD) ny = (y + 1 == h) ? 0 : y + 1;
+        else if (v < tUDL) nx = (x == 0) ? w - 1 : x - 1;
+        else nx = (x + 1 == w) ? 0 : x + 1;
+        if (!obs || !obs[(size_t)ny * (size_t)w + (size_t)nx]) {
+            x = nx;
+            y = ny;
+        }
+        if (x == cx && y == cy) {
+            *out_steps = step;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *run_rows(void *arg) {
+    RunShared *sh = (RunShared*)arg;
+    RwWorld *W = sh->W;
+    int cx = W->w / 2, cy = W->h / 2;
+    for (;;) {
+        int y = atomic_fetch_add(&sh->next_row, 1);
+        if (y >= W->h) break;
+        for (int x = 0; x < W->w; x++) {
+            size_t idx = (size_t)y * (size_t)W->w + (size_t)x;
+            if (x == cx && y == cy) continue;
+            if (W->obstacles && W->obstacles[idx]) continue;
+            Rng r;
+            rng_seed(&r, sh->run_seed, (uint64_t)idx + 1u);
+            uint32_t hits = 0;
+            uint64_t steps = 0;
+            for (int rep = 0; rep < sh->replications; rep++) {
+                int walk_steps = 0;
+                int hit = (sh->kernel == RW_KERNEL_REFERENCE)
+                              ? walk_reference(W, &r, x, y, &walk_steps)
+                              : walk_fast(W, &r, x, y, &walk_steps);
+                if (hit) {
+                    hits++;
+                    steps += (uint64_t)walk_steps;
+                }
+            }
+            W->hits[idx] += hits;
+            W->steps[idx] += steps;
+        }
+    }
+    return NULL;
+}
+
+int rwalk_run(RwWorld *W, int replications, RwKernel kernel, int threads) {
+    if (!W || replications <= 0) return 0;
+    size_t count = (size_t)W->w * (size_t)W->h;
+    if (!W->hits) W->hits = (uint32_t*)calloc(count, sizeof(*W->hits));
+    if (!W->steps) W->steps = (uint64_t*)calloc(count, sizeof(*W->steps));
+    if (!W->hits || !W->steps) return 0;
+
+    if (threads <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (ncpu > 0) ? (int)ncpu : 1;
+    }
+    if (threads > RWALK_MAX_THREADS) threads = RWALK_MAX_THREADS;
+    if (threads > W->h) threads = W->h;
+
+    RunShared sh;
+    sh.W = W;
+    sh.replications = replications;
+    sh.kernel = kernel;
+    sh.run_seed = W->seed ^ (W->runs * 0x9E3779B97F4A7C15ull);
+    atomic_init(&sh.next_row, 0);
+
+    pthread_t th[RWALK_MAX_THREADS];
+    int started = 0;
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&th[started], NULL, run_rows, &sh) != 0) break;
+        started++;
+    }
+    run_rows(&sh);
+    for (int t = 0; t < started; t++) {
+        pthread_join(th[t], NULL);
+    }
+    W->replications += replications;
+    W->runs++;
+    return 1;
+}
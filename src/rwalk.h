@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rng.h"
+
+// librwalk: the random walk simulation without sockets, clients or argv.
+// A world is a torus of w x h cells walked towards its centre cell; every
+// free cell other than the centre is a spawn point. Accumulators hold, per
+// cell, the walks that reached the centre and the steps they took.
+
+typedef struct RwWorld RwWorld;
+
+typedef enum {
+    RW_DIR_UP    = 0,
+    RW_DIR_DOWN  = 1,
+    RW_DIR_LEFT  = 2,
+    RW_DIR_RIGHT = 3,
+} RwDir;
+
+typedef enum {
+    RW_KERNEL_AUTO      = 0,
+    RW_KERNEL_REFERENCE = 1,   // float draws and modulo wrap, as rwalk_step
+    RW_KERNEL_FAST      = 2,   // integer thresholds and branch wrap, same results
+} RwKernel;
+
+#define RWALK_MAX_THREADS 64
+
+RwWorld *rwalk_world_create(int w, int h, int max_steps, float pU, float pD, float pL, float pR);
+void rwalk_world_free(RwWorld *W);
+
+// The map is borrowed, not copied, and must outlive the world. NULL clears it.
+void rwalk_world_set_obstacles(RwWorld *W, const uint8_t *obstacles);
+void rwalk_world_seed(RwWorld *W, uint64_t seed);
+void rwalk_world_reset(RwWorld *W);
+
+// Adds `replications` walks from every spawn cell to the accumulators.
+// threads <= 0 uses every online CPU. Each cell draws from its own stream,
+// so results depend on the seed and the run count but not on threads.
+int rwalk_run(RwWorld *W, int replications, RwKernel kernel, int threads);
+
+int rwalk_width(const RwWorld *W);
+int rwalk_height(const RwWorld *W);
+int rwalk_replications(const RwWorld *W);
+// Row-major w*h arrays; NULL until the first rwalk_run.
+const uint32_t *rwalk_hits(const RwWorld *W);
+const uint64_t *rwalk_steps(const RwWorld *W);
+
+// One step of the reference kernel from (*x, *y) using the caller's
+// generator; blocked moves leave the walker in place. Returns the RwDir drawn.
+int rwalk_step(const RwWorld *W, Rng *r, int *x, int *y);
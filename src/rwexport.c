@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "results_io.h"
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr,
+            "Usage: %s <results_file> <output.csv>\n"
+            "Example: %s replication_results.rwr replication_results.csv\n",
+            argv[0], argv[0]);
+        return 2;
+    }
+
+    ResultsMeta m;
+    uint32_t *hits = NULL;
+    uint64_t *steps = NULL;
+    if (!results_load_counts(argv[1], &m, &hits, &steps)) {
+        fprintf(stderr, "Failed to open results file %s\n", argv[1]);
+        return 1;
+    }
+
+    int ok = results_write_csv(argv[2], &m, hits, steps);
+    if (!ok) perror(argv[2]);
+    free(hits);
+    free(steps);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "results_io.h"
+
+#define MERGE_MAX_THREADS 16
+
+typedef struct {
+    ResultsFile rf;
+    uint32_t *hits;
+    uint64_t *steps;
+    ResultsMeta meta;
+} MergeInput;
+
+typedef struct {
+    MergeInput *inputs;
+    int input_count;
+    int world_w;
+    uint32_t *hits;
+    uint64_t *steps;
+    int y0, y1;
+    int overflow;
+} MergeJob;
+
+// The file formats store hits as 32 bits, so a sum that does not fit fails
+// the merge instead of wrapping.
+static int add_counts(uint32_t *hits, uint64_t *steps, uint32_t h, uint64_t s) {
+    if (h > UINT32_MAX - *hits || s > UINT64_MAX - *steps) return 0;
+    *hits += h;
+    *steps += s;
+    return 1;
+}
+
+static void *merge_rows(void *arg) {
+    MergeJob *j = (MergeJob*)arg;
+    size_t w = (size_t)j->world_w;
+
+    for (int i = 0; i < j->input_count; i++) {
+        MergeInput *in = &j->inputs[i];
+        if (in->hits) {
+            for (size_t idx = (size_t)j->y0 * w; idx < (size_t)j->y1 * w; idx++) {
+                if (!add_counts(&j->hits[idx], &j->steps[idx], in->hits[idx], in->steps[idx])) {
+                    j->overflow = 1;
+                    return NULL;
+                }
+            }
+            continue;
+        }
+        for (size_t t = 0; t < in->rf.tile_count; t++) {
+            const ResultsTileEntry *e = &in->rf.tiles[t];
+            int ty0 = (int)e->y0 > j->y0 ? (int)e->y0 : j->y0;
+            int ty1 = (int)(e->y0 + e->h) < j->y1 ? (int)(e->y0 + e->h) : j->y1;
+            if (ty0 >= ty1) continue;
+            const uint64_t *ts;
+            const uint32_t *th;
+            results_tile_columns(&in->rf, t, &ts, &th, NULL, NULL);
+            for (int y = ty0; y < ty1; y++) {
+                size_t src = (size_t)(y - (int)e->y0) * e->w;
+                size_t dst = (size_t)y * w + e->x0;
+                for (uint32_t x = 0; x < e->w; x++) {
+                    if (!add_counts(&j->hits[dst + x], &j->steps[dst + x], th[src + x], ts[src + x])) {
+                        j->overflow = 1;
+                        return NULL;
+                    }
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        fprintf(stderr,
+            "Usage: %s <output_file> <results_file> <results_file> [results_file...]\n"
+            "Example: %s merged.rwr run1.rwr run2.rwr run3.csv\n",
+            argv[0], argv[0]);
+        return 2;
+    }
+
+    int input_count = argc - 2;
+    MergeInput *inputs = (MergeInput*)calloc((size_t)input_count, sizeof(*inputs));
+    if (!inputs) {
+        perror("inputs alloc");
+        return 1;
+    }
+
+    int rc = 0;
+    long long total_reps = 0;
+    for (int i = 0; i < input_count && rc == 0; i++) {
+        MergeInput *in = &inputs[i];
+        const char *path = argv[i + 2];
+        // Binary inputs are read in place by row band; CSV has no index to
+        // seek by, so it is parsed into a full grid up front.
+        if (results_open(path, &in->rf)) {
+            results_meta_from_header(in->rf.hdr, &in->meta);
+        } else if (!results_load_counts(path, &in->meta, &in->hits, &in->steps)) {
+            fprintf(stderr, "Failed to open results file %s\n", path);
+            rc = 1;
+            break;
+        }
+        if (i > 0 && !results_same_config(&inputs[0].meta, &in->meta)) {
+            fprintf(stderr, "%s was produced with a different configuration than %s\n",
+                    path, argv[2]);
+            rc = 2;
+        }
+        total_reps += in->meta.replications;
+    }
+    if (rc == 0 && inputs[0].meta.obstacle_mode == 1) {
+        fprintf(stderr, "Warning: merging runs with randomly generated obstacles.\n");
+    }
+    if (rc == 0 && total_reps > INT32_MAX) {
+        fprintf(stderr, "Merged replication count is too large.\n");
+        rc = 2;
+    }
+
+    ResultsMeta out = inputs[0].meta;
+    size_t count = (size_t)out.world_w * (size_t)out.world_h;
+    uint32_t *hits = NULL;
+    uint64_t *steps = NULL;
+    if (rc == 0) {
+        hits = (uint32_t*)calloc(count, sizeof(*hits));
+        steps = (uint64_t*)calloc(count, sizeof(*steps));
+        if (!hits || !steps) {
+            perror("results alloc");
+            rc = 1;
+        }
+    }
+
+    if (rc == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        int nthreads = (ncpu > 0) ? (int)ncpu : 1;
+        if (nthreads > MERGE_MAX_THREADS) nthreads = MERGE_MAX_THREADS;
+        if (nthreads > out.world_h) nthreads = out.world_h;
+
+        MergeJob jobs[MERGE_MAX_THREADS];
+        pthread_t th[MERGE_MAX_THREADS];
+        int started[MERGE_MAX_THREADS] = {0};
+        for (int t = 0; t < nthreads; t++) {
+            jobs[t] = (MergeJob){
+                .inputs = inputs, .input_count = input_count, .world_w = out.world_w,
+                .hits = hits, .steps = steps,
+                .y0 = (int)((long long)out.world_h * t / nthreads),
+                .y1 = (int)((long long)out.world_h * (t + 1) / nthreads)
+            };
+        }
+        for (int t = 1; t < nthreads; t++) {
+            started[t] = (pthread_create(&th[t], NULL, merge_rows, &jobs[t]) == 0);
+            if (!started[t]) merge_rows(&jobs[t]);
+        }
+        merge_rows(&jobs[0]);
+        for (int t = 1; t < nthreads; t++) {
+            if (started[t]) pthread_join(th[t], NULL);
+        }
+        for (int t = 0; t < nthreads && rc == 0; t++) {
+            if (jobs[t].overflow) {
+                fprintf(stderr, "Merged counts do not fit a cell's hit or step counter.\n");
+                rc = 2;
+            }
+        }
+    }
+
+    if (rc == 0) {
+        out.replications = (int)total_reps;
+        int ok = results_is_csv_path(argv[1])
+            ? results_write_csv(argv[1], &out, hits, steps)
+            : results_write_binary(argv[1], &out, hits, steps);
+        if (!ok) {
+            perror(argv[1]);
+            rc = 1;
+        } else {
+            fprintf(stdout, "Merged %d files, %d replications -> %s\n",
+                    input_count, out.replications, argv[1]);
+        }
+    }
+
+    for (int i = 0; i < input_count; i++) {
+        results_close(&inputs[i].rf);
+        free(inputs[i].hits);
+        free(inputs[i].steps);
+    }
+    free(inputs);
+    free(hits);
+    free(steps);
+    return rc;
+}
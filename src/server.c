@@ -17,333 +17,206 @@
 #include "server_types.h"
 #include "server_net.h"
 #include "server_sim.h"
-
-
-static int check_reachability(int w, int h, const uint8_t *obs) {
-    if (!obs) return 1;
-    int cx = w / 2;
-    int cy = h / 2;
-    size_t start = (size_t)cy * (size_t)w + (size_t)cx;
-    if (obs[start]) return 0;
-
-    size_t count = (size_t)w * (size_t)h;
-    uint8_t *visited = (uint8_t*)calloc(count, sizeof(uint8_t));
-    int *queue = (int*)malloc(count * sizeof(int));
-    if (!visited || !queue) {
-        free(visited);
-        free(queue);
-        return 0;
-    }
-
-    int head = 0, tail = 0;
-    queue[tail++] = (int)start;
-    visited[start] = 1;
-
-    while (head < tail) {
-        int idx = queue[head++];
-        int x = idx % w;
-        int y = idx / w;
-
-        int nx[4] = { (x + 1) % w, (x - 1 + w) % w, x, x };
-        int ny[4] = { y, y, (y + 1) % h, (y - 1 + h) % h };
-        for (int i = 0; i < 4; i++) {
-            int nidx = ny[i] * w + nx[i];
-            if (obs[nidx] || visited[nidx]) continue;
-            visited[nidx] = 1;
-            queue[tail++] = nidx;
-        }
-    }
-
-    size_t reachable = 0;
-    size_t free_cells = 0;
-    for (size_t i = 0; i < count; i++) {
-        if (!obs[i]) {
-            free_cells++;
-            if (visited[i]) reachable++;
-        }
-    }
-
-    free(visited);
-    free(queue);
-    return reachable == free_cells;
+#include "server_checkpoint.h"
+#include "server_cache.h"
+#include "server_job.h"
+#include "server_host.h"
+#include "server_showcase.h"
+#include "server_loop.h"
+#include "results_io.h"
+
+
+static int env_int(const char *name, int def) {
+    const char *v = getenv(name);
+    if (!v || !*v) return def;
+    return atoi(v);
 }
 
-static float rand_float(void) {
-    return (float)rand() / (float)RAND_MAX;
+// RW_IO=uring moves client sockets and result/checkpoint writes onto
+// io_uring; anything else keeps epoll and pwrite.
+static int io_uring_wanted(void) {
+    const char *v = getenv("RW_IO");
+    int on = (v && strcmp(v, "uring") == 0);
+    results_io_use_uring(on);
+    return on;
 }
 
-static int load_obstacles_file(const char *path, int w, int h, uint8_t **out_obs) {
-    if (!path || !out_obs || w <= 0 || h <= 0) return 0;
-    FILE *fp = fopen(path, "r");
-    if (!fp) return 0;
-
-    size_t count = (size_t)w * (size_t)h;
-    uint8_t *obs = (uint8_t*)calloc(count, sizeof(uint8_t));
-    if (!obs) {
-        fclose(fp);
+static int block_signals(sigset_t *sigset) {
+    sigemptyset(sigset);
+    sigaddset(sigset, SIGINT);
+    sigaddset(sigset, SIGTERM);
+    int mask_rc = pthread_sigmask(SIG_BLOCK, sigset, NULL);
+    if (mask_rc != 0) {
+        fprintf(stderr, "pthread_sigmask: %s\n", strerror(mask_rc));
         return 0;
     }
-
-    char line[1024];
-    while (fgets(line, sizeof(line), fp)) {
-        int x = 0, y = 0;
-        int scanned = sscanf(line, " %d , %d ", &x, &y);
-        if (scanned != 2) {
-            size_t len = strcspn(line, "\r\n");
-            if (len == 0) continue;
-            fclose(fp);
-            free(obs);
-            return 0;
-        }
-        if (x < 0 || x >= w || y < 0 || y >= h) {
-            fclose(fp);
-            free(obs);
-            return 0;
-        }
-        obs[(size_t)y * (size_t)w + (size_t)x] = 1;
-    }
-
-    fclose(fp);
-    *out_obs = obs;
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
     return 1;
 }
 
-static int generate_random_obstacles(Server *S) {
-    if (!S->obstacle_mode) return 1;
-    if (S->world_w < 3 || S->world_h < 3) return 0;
-
-    size_t count = (size_t)S->world_w * (size_t)S->world_h;
-    S->obstacles = (uint8_t*)calloc(count, sizeof(uint8_t));
-    if (!S->obstacles) return 0;
-
-    float density = S->obstacle_density;
-    if (density < 0.0f) density = 0.0f;
-    if (density > 0.8f) density = 0.8f;
-
-    int cx = S->world_w / 2;
-    int cy = S->world_h / 2;
-
-    for (int attempt = 0; attempt < 2000; attempt++) {
-        memset(S->obstacles, 0, count);
-        for (int y = 0; y < S->world_h; y++) {
-            for (int x = 0; x < S->world_w; x++) {
-                if ((x == 0 && y == 0) || (x == cx && y == cy)) continue;
-                if (rand_float() < density) {
-                    size_t idx = (size_t)y * (size_t)S->world_w + (size_t)x;
-                    S->obstacles[idx] = 1;
-                }
-            }
-        }
-        if (check_reachability(S->world_w, S->world_h, S->obstacles)) {
-            return 1;
-        }
+static void signal_ready(const char *sock_path) {
+    fprintf(stdout, "SERVER READY: %s\n", sock_path);
+    fflush(stdout);
+    int ready_fd = env_int("RW_READY_FD", -1);
+    if (ready_fd >= 0) {
+        dprintf(ready_fd, "SERVER READY: %s\n", sock_path);
+        close(ready_fd);
     }
-    fprintf(stderr,"Faild to find world with full reachability and with obstacle density %.2f.\n",density);
-    fflush(stderr);
-    free(S->obstacles);
-    S->obstacles = NULL;
-    return 0;
 }
 
-static int init_obstacles(Server *S) {
-    if (!S->obstacle_mode) return 1;
+// Multi-session mode: sessions are created by the clients that name them
+// and share one pool of RW_WORKERS workers.
+static int run_host(const char *sock_path) {
+    Host H;
+    memset(&H, 0, sizeof(H));
+    snprintf(H.sock_path, sizeof(H.sock_path), "%s", sock_path);
+    const char *seed_env = getenv("RW_SEED");
+    H.seed_fixed = (seed_env && *seed_env);
+    if (H.seed_fixed) {
+        H.seed = strtoull(seed_env, NULL, 10);
+    } else {
+        H.seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
+    H.history_limit = env_int("RW_HISTORY_WINDOW", HISTORY_DEFAULT_WINDOW);
+    outq_config_env(&H.outq);
+    publish_config_env(H.publish_hz);
+    H.use_uring = io_uring_wanted();
+    H.workers = env_int("RW_WORKERS", 0);
+    H.slice_ms = env_int("RW_SLICE_MS", HOST_DEFAULT_SLICE_MS);
+    int idle_secs = env_int("RW_IDLE_SECS", HOST_DEFAULT_IDLE_SECS);
 
-    if (S->obstacle_mode == 2) {
-        uint8_t *obs = NULL;
-        if (!load_obstacles_file(S->obstacle_file, S->world_w, S->world_h, &obs)) {
-            fprintf(stderr, "Failed to load obstacle file %s\n", S->obstacle_file);
-            return 0;
-        }
-        int cx = S->world_w / 2;
-        int cy = S->world_h / 2;
-        if (obs[(size_t)cy * (size_t)S->world_w + (size_t)cx]) {
-            fprintf(stderr, "Obstacle at center is not allowed.\n");
-            free(obs);
-            return 0;
-        }
-        if (!check_reachability(S->world_w, S->world_h, obs)) {
-            fprintf(stderr, "Obstacle world is not fully reachable from [0,0].\n");
-            free(obs);
-            return 0;
-        }
-        S->obstacles = obs;
-        S->obstacle_density = 0.0f;
+    sigset_t sigset;
+    if (!block_signals(&sigset)) return 1;
+    if (!host_start(&H)) {
+        perror("server socket");
         return 1;
     }
+    signal_ready(H.sock_path);
 
-    return generate_random_obstacles(S);
+    struct timespec idle_since;
+    clock_gettime(CLOCK_MONOTONIC, &idle_since);
+    for (;;) {
+        struct timespec ts = { .tv_sec = 1, .tv_nsec = 0 };
+        int sig = sigtimedwait(&sigset, NULL, &ts);
+        if (sig == SIGINT || sig == SIGTERM) break;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!host_idle(&H)) {
+            idle_since = now;
+        } else if (now.tv_sec - idle_since.tv_sec >= idle_secs) {
+            break;
+        }
+    }
+
+    host_stop(&H);
+    fprintf(stdout, "SERVER SHUTDOWN COMPLETE.\n");
+    fflush(stdout);
+    return 0;
 }
 
 int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "--sessions") == 0) {
+        return run_host(argv[2]);
+    }
     if (argc < 11) {
         fprintf(stderr,
-            "Usage: %s <sock_path> <world_w> <world_h> <delay_ms> <replications> <max_steps> <pU> <pD> <pL> <pR> [output_file] [base_replications] [obstacle_mode] [obstacle_density] [obstacle_file] [start_on_client]\n"
-            "Example: %s /tmp/rwalk.sock 101 101 10 5 100 0.25 0.25 0.25 0.25 results.csv 50 1 0.2\n",
-            argv[0], argv[0]);
+            "Usage: %s <sock_path> <world_w> <world_h> <delay_ms> <replications> <max_steps> <pU> <pD> <pL> <pR> [output_file] [base_replications] [obstacle_mode] [obstacle_density] [obstacle_file] [start_on_client] [base_results_file]\n"
+            "       %s --sessions <sock_path>\n"
+            "Example: %s /tmp/rwalk.sock 101 101 10 5 100 0.25 0.25 0.25 0.25 results.rwr 50 1 0.2\n",
+            argv[0], argv[0], argv[0]);
         return 2;
     }
 
-    srand((unsigned)time(NULL));
-
     Server S;
     memset(&S, 0, sizeof(S));
     pthread_mutex_init(&S.clients_mtx, NULL);
-    pthread_mutex_init(&S.hist_mtx, NULL);
+    pthread_mutex_init(&S.job_mtx, NULL);
+    pthread_cond_init(&S.job_cv, NULL);
 
+    MsgJob job;
+    memset(&job, 0, sizeof(job));
     strncpy(S.sock_path, argv[1], sizeof(S.sock_path) - 1);
-    S.world_w = atoi(argv[2]);
-    S.world_h = atoi(argv[3]);
-    S.step_delay_ms = atoi(argv[4]);
-    S.replications = atoi(argv[5]);    
-    S.max_steps    = atoi(argv[6]);
-    S.pU = strtof(argv[7], NULL);
-    S.pD = strtof(argv[8], NULL);
-    S.pL = strtof(argv[9], NULL);
-    S.pR = strtof(argv[10], NULL);
-    const char *results_path = (argc >= 12) ? argv[11] : "replication_results.csv";
-    S.base_replications = (argc >= 13) ? atoi(argv[12]) : 0;
-    S.obstacle_mode = (argc >= 14) ? atoi(argv[13]) : 0;
-    S.obstacle_density = (argc >= 15) ? strtof(argv[14], NULL) : 0.0f;
+    job.world_w = atoi(argv[2]);
+    job.world_h = atoi(argv[3]);
+    job.step_delay_ms = atoi(argv[4]);
+    job.replications = atoi(argv[5]);
+    job.max_steps    = atoi(argv[6]);
+    job.pU = strtof(argv[7], NULL);
+    job.pD = strtof(argv[8], NULL);
+    job.pL = strtof(argv[9], NULL);
+    job.pR = strtof(argv[10], NULL);
+    snprintf(job.results_path, sizeof(job.results_path), "%s",
+             (argc >= 12) ? argv[11] : "replication_results.rwr");
+    job.base_replications = (argc >= 13) ? atoi(argv[12]) : 0;
+    job.obstacle_mode = (argc >= 14) ? atoi(argv[13]) : 0;
+    job.obstacle_density = (argc >= 15) ? strtof(argv[14], NULL) : 0.0f;
     if (argc >= 16) {
-        strncpy(S.obstacle_file, argv[15], sizeof(S.obstacle_file) - 1);
-        S.obstacle_file[sizeof(S.obstacle_file) - 1] = '\0';
-    } else {
-        S.obstacle_file[0] = '\0';
+        snprintf(job.obstacle_file, sizeof(job.obstacle_file), "%s", argv[15]);
     }
     int start_on_client = (argc >= 17) ? atoi(argv[16]) : 0;
-    if (S.obstacle_mode != 2) {
-        S.obstacle_file[0] = '\0';
-    }
-    if (S.obstacle_mode == 0) {
-        S.obstacle_density = 0.0f;
+    if (argc >= 18) {
+        snprintf(job.base_file, sizeof(job.base_file), "%s", argv[17]);
     }
-    if (S.base_replications < 0) S.base_replications = 0;
 
-    S.results_fp = fopen(results_path, "w");
-    if (!S.results_fp) {
-        perror(results_path);
-        return 1;
-    }
-    float psum = S.pU + S.pD + S.pL + S.pR;
-    if (S.step_delay_ms < 0 || (psum < 0.999f || psum > 1.001f)) {
-        fprintf(stderr, "Invalid args (delay>=0, probabilities sum ~ 1).\n");
-        fclose(S.results_fp);
-        return 2;
-    }
-    if (S.obstacle_mode != 2 && (S.world_w <= 2 || S.world_h <= 2)) {
-        fprintf(stderr, "Invalid args (world sizes >2).\n");
-        fclose(S.results_fp);
-        return 2;
-    }
-    if (S.replications <= 0 || S.max_steps <= 0) {
-        fprintf(stderr, "replications and max_steps must be > 0\n");
-        fclose(S.results_fp);
-        return 2;
-    }
-    if (S.obstacle_mode < 0 || S.obstacle_mode > 2) {
-        fprintf(stderr, "obstacle_mode must be 0, 1, or 2\n");
-        fclose(S.results_fp);
-        return 2;
-    }
-    if (S.obstacle_mode == 2 && S.obstacle_file[0] == '\0') {
-        fprintf(stderr, "obstacle_file is required when obstacle_mode=2\n");
-        fclose(S.results_fp);
-        return 2;
-    }
+    job.budget_secs = env_int("RW_BUDGET_SECS", 0);
 
-    if (!init_obstacles(&S)) {
-        fprintf(stderr,"Obstacle init fail.");
-        fflush(stderr);
-        fclose(S.results_fp);
+    const char *seed_env = getenv("RW_SEED");
+    S.seed_fixed = (seed_env && *seed_env);
+    if (S.seed_fixed) {
+        S.seed = strtoull(seed_env, NULL, 10);
+    } else {
+        S.seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
+    const char *ckpt = getenv("RW_CHECKPOINT");
+    if (ckpt && *ckpt) {
+        snprintf(S.checkpoint_path, sizeof(S.checkpoint_path), "%s", ckpt);
+    }
+    S.checkpoint_secs = env_int("RW_CHECKPOINT_SECS", CHECKPOINT_DEFAULT_SECS);
+    if (S.checkpoint_secs < 1) S.checkpoint_secs = 1;
+    S.history_limit = env_int("RW_HISTORY_WINDOW", HISTORY_DEFAULT_WINDOW);
+    outq_config_env(&S.outq);
+    publish_config_env(S.publish_hz);
+    int use_uring = io_uring_wanted();
+    S.idle_secs = env_int("RW_IDLE_SECS", JOB_DEFAULT_IDLE_SECS);
+    S.shards = env_int("RW_SHARDS", 0);
+    const char *resume = getenv("RW_RESUME");
+    if (S.shards > 1 && (S.checkpoint_path[0] || (resume && *resume))) {
+        fprintf(stderr, "RW_SHARDS ignored: checkpointed runs use a single process.\n");
+        S.shards = 0;
+    }
+
+    // Before job_apply, so the result writer threads inherit the mask.
+    sigset_t sigset;
+    if (!block_signals(&sigset)) return 1;
+
+    if (!job_validate(&job)) {
         return 2;
     }
-    if (S.world_w <= 2 || S.world_h <= 2) {
-        fprintf(stderr, "Invalid world size (must be > 2).\n");
-        fclose(S.results_fp);
+    if (!job_apply(&S, &job, resume)) {
+        job_release(&S);
         return 2;
     }
 
     atomic_store(&S.mode, MODE_INTERACTIVE);
-    atomic_store(&S.current_replication, 0);
-    atomic_store(&S.current_step, 0);
+    atomic_store(&S.alive, 1);
     atomic_store(&S.running, 1);
     atomic_store(&S.sim_started, 0);
     atomic_store(&S.active_clients, 0);
 
-    sigset_t sigset;
-    sigemptyset(&sigset);
-    sigaddset(&sigset, SIGINT);
-    sigaddset(&sigset, SIGTERM);
-    int mask_rc = pthread_sigmask(SIG_BLOCK, &sigset, NULL);
-    if (mask_rc != 0) {
-        fprintf(stderr, "pthread_sigmask: %s\n", strerror(mask_rc));
-        fclose(S.results_fp);
-        return 1;
-    }
-    signal(SIGHUP, SIG_IGN);
-    signal(SIGPIPE, SIG_IGN);
-
-    S.history_cap = S.max_steps + 1;
-    S.history = (MsgStep*)calloc((size_t)S.history_cap, sizeof(*S.history));
-    if (!S.history) {
-        perror("history alloc");
-        fclose(S.results_fp);
-        return 1;
-    }
-    S.history[0].x = S.world_w / 2;
-    S.history[0].y = S.world_h / 2;
-    S.history[0].step_index = 0;
-
-    S.steps_to_center = (int**)calloc((size_t)S.world_h, sizeof(*S.steps_to_center));
-    S.succesful_replications = (int**)calloc((size_t)S.world_h, sizeof(*S.succesful_replications));
-    S.prob_to_center = (float**)calloc((size_t)S.world_h, sizeof(*S.prob_to_center));
-    S.avg_steps_to_center = (float**)calloc((size_t)S.world_h, sizeof(*S.avg_steps_to_center));
-    if (!S.steps_to_center || !S.succesful_replications || !S.prob_to_center || !S.avg_steps_to_center) {
-        perror("steps_to_center || succesful_replications  rows alloc");
-        if (S.steps_to_center) free(S.steps_to_center);
-        if (S.succesful_replications) free(S.succesful_replications);
-        if (S.prob_to_center) free(S.prob_to_center);
-        if (S.avg_steps_to_center) free(S.avg_steps_to_center);
-        free(S.history);
-        fclose(S.results_fp);
-        return 1;
-    }
-    S.steps_to_center[0] = (int*)calloc((size_t)S.world_w * (size_t)S.world_h,sizeof(**S.steps_to_center));
-    S.succesful_replications[0] = (int*)calloc((size_t)S.world_w * (size_t)S.world_h,sizeof(**S.succesful_replications));
-    S.prob_to_center[0] = (float*)calloc((size_t)S.world_w * (size_t)S.world_h, sizeof(**S.prob_to_center));
-    S.avg_steps_to_center[0] = (float*)calloc((size_t)S.world_w * (size_t)S.world_h, sizeof(**S.avg_steps_to_center));
-    if (!S.steps_to_center[0] || !S.succesful_replications[0] || !S.prob_to_center[0] || !S.avg_steps_to_center[0]) {
-        perror("steps_to_center || S.succesful_replicationsdata alloc");
-        if (S.steps_to_center[0]) free(S.steps_to_center[0]);
-        if (S.succesful_replications[0]) free(S.succesful_replications[0]);
-        if (S.prob_to_center[0]) free(S.prob_to_center[0]);
-        if (S.avg_steps_to_center[0]) free(S.avg_steps_to_center[0]);
-        free(S.succesful_replications);
-        free(S.steps_to_center);
-        free(S.prob_to_center);
-        free(S.avg_steps_to_center);
-        free(S.history);
-        fclose(S.results_fp);
-        return 1;
-    }
-    for (int y = 1; y < S.world_h; y++) {
-        S.steps_to_center[y] = S.steps_to_center[0] + (size_t)y * (size_t)S.world_w;
-        S.succesful_replications[y] = S.succesful_replications[0] + (size_t)y * (size_t)S.world_w;
-        S.prob_to_center[y] = S.prob_to_center[0] + (size_t)y * (size_t)S.world_w;
-        S.avg_steps_to_center[y] = S.avg_steps_to_center[0] + (size_t)y * (size_t)S.world_w;
-    }
-
-    
     if (make_listen_socket(&S) != 0) {
         perror("server socket");
-        fclose(S.results_fp);
         return 1;
     }
 
-    fprintf(stdout, "SERVER READY: %s\n", S.sock_path);
-    fflush(stdout);
+    signal_ready(S.sock_path);
 
-    pthread_create(&S.accept_th, NULL, accept_thread, &S);
+    showcase_start(&S);
+    NetLoop loop;
+    S.loop = &loop;
+    if (!net_loop_start(&loop, S.listen_fd, &S, NULL, use_uring)) {
+        return 1;
+    }
     if (!start_on_client) {
         int expected = 0;
         if (atomic_compare_exchange_strong(&S.sim_started, &expected, 1)) {
@@ -355,48 +228,39 @@ int main(int argc, char **argv) {
     }
 
     int stop_requested = 0;
-    while (!stop_requested && atomic_load(&S.running)) {
+    struct timespec idle_since;
+    clock_gettime(CLOCK_MONOTONIC, &idle_since);
+    while (!stop_requested && atomic_load(&S.alive)) {
         struct timespec ts = { .tv_sec = 1, .tv_nsec = 0 };
         int sig = sigtimedwait(&sigset, NULL, &ts);
         if (sig == SIGINT || sig == SIGTERM) {
             stop_requested = 1;
         }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!job_idle(&S)) {
+            idle_since = now;
+        } else if (now.tv_sec - idle_since.tv_sec >= S.idle_secs) {
+            break;
+        }
     }
 
     while (atomic_load(&S.active_clients) > 0) {
         sleep(1);
     }
+    atomic_store(&S.alive, 0);
     atomic_store(&S.running, 0);
-    shutdown(S.listen_fd, SHUT_RDWR);
-    pthread_join(S.accept_th, NULL);
+    job_wake(&S);
+    net_loop_stop(&loop);
     if (atomic_load(&S.sim_started)) {
         pthread_join(S.sim_th, NULL);
     }
     close(S.listen_fd);
     unlink(S.sock_path);
 
-    if (S.steps_to_center) {
-        free(S.steps_to_center[0]);
-        free(S.steps_to_center);
-    }
-    if (S.succesful_replications) {
-        free(S.succesful_replications[0]);
-        free(S.succesful_replications);
-    }
-    if (S.prob_to_center) {
-        free(S.prob_to_center[0]);
-        free(S.prob_to_center);
-    }
-    if (S.avg_steps_to_center) {
-        free(S.avg_steps_to_center[0]);
-        free(S.avg_steps_to_center);
-    }
-    if (S.obstacles) {
-        free(S.obstacles);
-    }
-    free(S.history);
+    showcase_stop(&S);
+    job_release(&S);
     fprintf(stdout, "SERVER SHUTDOWN COMPLETE.\n");
     fflush(stdout);
-    fclose(S.results_fp);
     return 0;
 }
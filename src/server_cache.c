@@ -0,0 +1,126 @@
+#include "server_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t n) {
+    const uint8_t *p = (const uint8_t*)data;
+    for (size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+uint64_t cache_key(const Server *S, int fixed_seed) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    // Sharded runs draw per-block streams, so a fixed seed gives other numbers.
+    int32_t estimator = (S->shards > 1) ? CACHE_ESTIMATOR_SHARDED : CACHE_ESTIMATOR_MC;
+    int32_t ints[4] = { S->world_w, S->world_h, S->max_steps, estimator };
+    float probs[4] = { S->pU, S->pD, S->pL, S->pR };
+    h = fnv1a(h, ints, sizeof(ints));
+    h = fnv1a(h, probs, sizeof(probs));
+    uint64_t seed = fixed_seed ? S->seed : 0;
+    h = fnv1a(h, &seed, sizeof(seed));
+    uint8_t has_obs = S->obstacles ? 1 : 0;
+    h = fnv1a(h, &has_obs, sizeof(has_obs));
+    if (S->obstacles) {
+        h = fnv1a(h, S->obstacles, (size_t)S->world_w * (size_t)S->world_h);
+    }
+    return h;
+}
+
+static int make_dirs(char *path) {
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        int rc = mkdir(path, 0755);
+        *p = '/';
+        if (rc != 0 && errno != EEXIST) return 0;
+    }
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+static int cache_dir(char *out, size_t cap) {
+    const char *dir = getenv("RW_CACHE_DIR");
+    if (dir && *dir) {
+        snprintf(out, cap, "%s", dir);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home || !*home) return 0;
+        snprintf(out, cap, "%s/.cache/rwalk", home);
+    }
+    return make_dirs(out);
+}
+
+int cache_prepare(Server *S, int fixed_seed) {
+    S->cache_path[0] = '\0';
+    S->cached_replications = 0;
+    const char *enabled = getenv("RW_CACHE");
+    if (enabled && strcmp(enabled, "0") == 0) return 1;
+
+    char dir[200];
+    if (!cache_dir(dir, sizeof(dir))) {
+        fprintf(stderr, "Results cache disabled: cannot create cache directory.\n");
+        return 1;
+    }
+    uint64_t key = cache_key(S, fixed_seed);
+    snprintf(S->cache_path, sizeof(S->cache_path), "%s/%016llx.rwr", dir, (unsigned long long)key);
+
+    ResultsMeta m;
+    uint32_t *hits = NULL;
+    uint64_t *steps = NULL;
+    int target = S->base_replications + S->replications;
+    if (!S->resuming && results_load_counts(S->cache_path, &m, &hits, &steps)) {
+        int usable = m.world_w == S->world_w && m.world_h == S->world_h &&
+                     m.max_steps == S->max_steps && m.replications > S->base_replications;
+        if (usable && m.replications > target) {
+            // The counts cannot be cut back to the job's size, and storing
+            // this job would replace the longer entry, so the cache sits out.
+            fprintf(stdout, "Results cache entry %016llx has %d replications, more than this job's %d; not used\n",
+                    (unsigned long long)key, m.replications, target);
+            fflush(stdout);
+            S->cache_path[0] = '\0';
+        } else if (usable) {
+            size_t count = (size_t)S->world_w * (size_t)S->world_h;
+            memcpy(S->succesful_replications[0], hits, count * sizeof(*hits));
+            memcpy(S->steps_to_center[0], steps, count * sizeof(*steps));
+            S->cached_replications = m.replications - S->base_replications;
+            fprintf(stdout, "Results cache hit %016llx: %d replications cached, %d to run\n",
+                    (unsigned long long)key, m.replications, target - m.replications);
+            fflush(stdout);
+        }
+        free(hits);
+        free(steps);
+    }
+
+    if (S->cache_path[0] &&
+        !results_writer_reset(&S->cache, S->cache_path, (size_t)S->world_w * (size_t)S->world_h,
+                              NULL, NULL)) {
+        S->cache_path[0] = '\0';
+    }
+    return 1;
+}
+
+void cache_store(Server *S, int reps) {
+    if (!S->cache_path[0] || reps <= 0) return;
+
+    ResultsMeta m;
+    memset(&m, 0, sizeof(m));
+    m.world_w = S->world_w;
+    m.world_h = S->world_h;
+    m.pU = S->pU; m.pD = S->pD; m.pL = S->pL; m.pR = S->pR;
+    m.max_steps = S->max_steps;
+    m.replications = S->base_replications + reps;
+    m.obstacle_mode = S->obstacle_mode;
+    m.obstacle_density = S->obstacle_density;
+    snprintf(m.obstacle_file, sizeof(m.obstacle_file), "%s", S->obstacle_file);
+    results_writer_submit(&S->cache, &m, S->succesful_replications, S->steps_to_center, NULL);
+}
+
+void cache_finish(Server *S) {
+    results_writer_finish(&S->cache);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "server_types.h"
+
+#define CACHE_ESTIMATOR_MC 1
+#define CACHE_ESTIMATOR_SHARDED 2
+
+uint64_t cache_key(const Server *S, int fixed_seed);
+int cache_prepare(Server *S, int fixed_seed);
+void cache_store(Server *S, int reps);
+void cache_finish(Server *S);
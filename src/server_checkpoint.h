@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "server_types.h"
+
+#define CHECKPOINT_MAGIC "RWCKPT\0\0"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_DEFAULT_SECS 60
+
+#pragma pack(push, 1)
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t world_w;
+    uint32_t world_h;
+    float pU, pD, pL, pR;
+    uint32_t max_steps;
+    uint32_t replications;
+    uint32_t base_replications;
+    uint32_t rep_begin;
+    uint32_t rep_end;
+    uint64_t next_cell;
+    uint64_t seed;
+    uint64_t rng_state;
+    uint32_t obstacle_mode;
+    float obstacle_density;
+    uint32_t has_obstacles;
+    uint32_t reserved;
+} CheckpointHeader;
+#pragma pack(pop)
+
+int checkpoint_write(const char *path, const ResultsSnapshot *s, void *ctx);
+int checkpoint_resume(Server *S, const char *path);
+void checkpoint_maybe(Server *S, int rep_begin, int rep_end, uint64_t next_cell);
+void checkpoint_now(Server *S, int rep_begin, int rep_end, uint64_t next_cell);
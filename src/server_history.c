@@ -0,0 +1,139 @@
+#include "server_history.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RELAXED memory_order_relaxed
+
+int history_init(StepHistory *h, int window) {
+    memset(h, 0, sizeof(*h));
+    if (window < 2 * HISTORY_KEY_INTERVAL) window = 2 * HISTORY_KEY_INTERVAL;
+    h->window = window;
+    h->key_cap = window / HISTORY_KEY_INTERVAL + 2;
+    h->dirs = (_Atomic uint8_t*)calloc(((size_t)window + 3u) / 4u, sizeof(*h->dirs));
+    h->key_x = (atomic_int*)calloc((size_t)h->key_cap, sizeof(*h->key_x));
+    h->key_y = (atomic_int*)calloc((size_t)h->key_cap, sizeof(*h->key_y));
+    if (!h->dirs || !h->key_x || !h->key_y) {
+        history_free(h);
+        return 0;
+    }
+    atomic_init(&h->gen, 0);
+    atomic_init(&h->head, 0);
+    return 1;
+}
+
+void history_free(StepHistory *h) {
+    free((void*)h->dirs);
+    free(h->key_x);
+    free(h->key_y);
+    h->dirs = NULL;
+    h->key_x = NULL;
+    h->key_y = NULL;
+}
+
+int history_resize(StepHistory *h, int window) {
+    if (window < 2 * HISTORY_KEY_INTERVAL) window = 2 * HISTORY_KEY_INTERVAL;
+    if (h->dirs && h->window == window) return 1;
+    history_free(h);
+    return history_init(h, window);
+}
+
+void history_begin(StepHistory *h, MsgStep start) {
+    unsigned g = atomic_load_explicit(&h->gen, RELAXED);
+    atomic_store_explicit(&h->gen, g + 1u, RELAXED);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&h->start_x, start.x, RELAXED);
+    atomic_store_explicit(&h->start_y, start.y, RELAXED);
+    atomic_store_explicit(&h->key_x[0], start.x, RELAXED);
+    atomic_store_explicit(&h->key_y[0], start.y, RELAXED);
+    atomic_store_explicit(&h->head, 0, RELAXED);
+    atomic_store_explicit(&h->gen, g + 2u, memory_order_release);
+}
+
+void history_push(StepHistory *h, int dir, MsgStep st) {
+    unsigned g = atomic_load_explicit(&h->gen, RELAXED);
+    atomic_store_explicit(&h->gen, g + 1u, RELAXED);
+    atomic_thread_fence(memory_order_release);
+    uint32_t slot = (st.step_index - 1u) % (uint32_t)h->window;
+    unsigned shift = (slot & 3u) * 2u;
+    _Atomic uint8_t *b = &h->dirs[slot / 4u];
+    uint8_t v = atomic_load_explicit(b, RELAXED);
+    atomic_store_explicit(b, (uint8_t)((v & ~(3u << shift)) | ((unsigned)dir << shift)), RELAXED);
+
+    if (st.step_index % HISTORY_KEY_INTERVAL == 0) {
+        uint32_t k = (st.step_index / HISTORY_KEY_INTERVAL) % (uint32_t)h->key_cap;
+        atomic_store_explicit(&h->key_x[k], st.x, RELAXED);
+        atomic_store_explicit(&h->key_y[k], st.y, RELAXED);
+    }
+    atomic_store_explicit(&h->head, st.step_index, RELAXED);
+    atomic_store_explicit(&h->gen, g + 2u, memory_order_release);
+}
+
+static uint32_t first_step(const StepHistory *h, uint32_t head) {
+    if (head < (uint32_t)h->window) return 0;
+    uint32_t first = head - (uint32_t)h->window + 1u;
+    return (first + HISTORY_KEY_INTERVAL - 1u) / HISTORY_KEY_INTERVAL * HISTORY_KEY_INTERVAL;
+}
+
+int history_snapshot(StepHistory *h, int world_w, int world_h, const uint8_t *obs,
+                     MsgStep **out) {
+    size_t dir_bytes = ((size_t)h->window + 3u) / 4u;
+    uint8_t *dirs = (uint8_t*)malloc(dir_bytes);
+    if (!dirs) return 0;
+
+    for (int attempt = 0; attempt < HISTORY_MAX_RETRIES; attempt++) {
+        unsigned g1 = atomic_load_explicit(&h->gen, memory_order_acquire);
+        if (g1 & 1u) continue;
+        uint32_t head = atomic_load_explicit(&h->head, RELAXED);
+        uint32_t first = first_step(h, head);
+
+        MsgStep start = {
+            .x = atomic_load_explicit(&h->start_x, RELAXED),
+            .y = atomic_load_explicit(&h->start_y, RELAXED),
+            .step_index = 0
+        };
+        uint32_t k = (first / HISTORY_KEY_INTERVAL) % (uint32_t)h->key_cap;
+        MsgStep cur = {
+            .x = atomic_load_explicit(&h->key_x[k], RELAXED),
+            .y = atomic_load_explicit(&h->key_y[k], RELAXED),
+            .step_index = first
+        };
+        for (size_t i = 0; i < dir_bytes; i++) {
+            dirs[i] = atomic_load_explicit(&h->dirs[i], RELAXED);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&h->gen, RELAXED) != g1) continue;
+
+        int count = (int)(head - first) + 1 + (first > 0 ? 1 : 0);
+        MsgStep *steps = (MsgStep*)malloc((size_t)count * sizeof(*steps));
+        if (!steps) break;
+
+        int n = 0;
+        if (first > 0) steps[n++] = start;
+        steps[n++] = cur;
+        for (uint32_t i = first + 1u; i <= head; i++) {
+            uint32_t slot = (i - 1u) % (uint32_t)h->window;
+            int nx = cur.x, ny = cur.y;
+            switch ((dirs[slot / 4u] >> ((slot & 3u) * 2u)) & 3u) {
+            case DIR_UP:    ny = (ny - 1 + world_h) % world_h; break;
+            case DIR_DOWN:  ny = (ny + 1) % world_h; break;
+            case DIR_LEFT:  nx = (nx - 1 + world_w) % world_w; break;
+            default:        nx = (nx + 1) % world_w; break;
+            }
+            if (!obs || !obs[(size_t)ny * (size_t)world_w + (size_t)nx]) {
+                cur.x = nx;
+                cur.y = ny;
+            }
+            cur.step_index = i;
+            steps[n++] = cur;
+        }
+
+        free(dirs);
+        *out = steps;
+        return n;
+    }
+
+    free(dirs);
+    return 0;
+}
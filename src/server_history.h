@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "shared.h"
+#include "rwalk.h"
+
+#define HISTORY_DEFAULT_WINDOW 65536
+#define HISTORY_KEY_INTERVAL 256
+#define HISTORY_MAX_RETRIES 64
+
+typedef enum {
+    DIR_UP    = RW_DIR_UP,
+    DIR_DOWN  = RW_DIR_DOWN,
+    DIR_LEFT  = RW_DIR_LEFT,
+    DIR_RIGHT = RW_DIR_RIGHT,
+} StepDir;
+
+// Single writer (the showcase walker), any number of readers, as a seqlock:
+// the writer makes gen odd before it touches the ring and even again after,
+// readers copy the ring and retry when gen was odd or moved meanwhile.
+typedef struct {
+    int window;
+    int key_cap;
+    _Atomic uint8_t *dirs;
+    atomic_int *key_x;
+    atomic_int *key_y;
+    atomic_int start_x, start_y;
+    atomic_uint gen;
+    atomic_uint head;
+} StepHistory;
+
+int history_init(StepHistory *h, int window);
+void history_free(StepHistory *h);
+int history_resize(StepHistory *h, int window);
+void history_begin(StepHistory *h, MsgStep start);
+void history_push(StepHistory *h, int dir, MsgStep st);
+int history_snapshot(StepHistory *h, int world_w, int world_h, const uint8_t *obs,
+                     MsgStep **out);
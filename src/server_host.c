@@ -0,0 +1,280 @@
+#include "server_host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server_job.h"
+#include "server_net.h"
+#include "server_sim.h"
+#include "server_showcase.h"
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t session_hash(const char *id) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (const char *p = id; *p; p++) {
+        h ^= (uint8_t)*p;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Caller holds H->mtx. Sessions that become runnable start no further
+// behind than the least-served runnable one, so idle time is not banked.
+static uint64_t vtime_floor(Host *H, const Server *skip) {
+    uint64_t floor = UINT64_MAX;
+    for (Server *S = H->sessions; S; S = S->next_session) {
+        if (S == skip || !(S->runnable || S->on_cpu)) continue;
+        if (S->vtime < floor) floor = S->vtime;
+    }
+    return floor;
+}
+
+static Server *session_get(Host *H, const char *id, uint32_t priority) {
+    pthread_mutex_lock(&H->mtx);
+    Server *S = H->sessions;
+    while (S && strcmp(S->session_id, id) != 0) S = S->next_session;
+    if (!S) {
+        if (H->nsessions >= HOST_MAX_SESSIONS) {
+            pthread_mutex_unlock(&H->mtx);
+            fprintf(stderr, "Server: session limit (%d) reached; refusing session %s\n",
+                    HOST_MAX_SESSIONS, id);
+            return NULL;
+        }
+        S = (Server*)calloc(1, sizeof(*S));
+        if (!S) {
+            pthread_mutex_unlock(&H->mtx);
+            return NULL;
+        }
+        pthread_mutex_init(&S->clients_mtx, NULL);
+        pthread_mutex_init(&S->job_mtx, NULL);
+        pthread_cond_init(&S->job_cv, NULL);
+        snprintf(S->session_id, sizeof(S->session_id), "%s", id);
+        snprintf(S->sock_path, sizeof(S->sock_path), "%s", H->sock_path);
+        S->host = H;
+        S->listen_fd = -1;
+        S->priority = HOST_DEFAULT_PRIORITY;
+        S->seed_fixed = H->seed_fixed;
+        S->seed = H->seed ^ session_hash(id);
+        S->history_limit = H->history_limit;
+        S->outq = H->outq;
+        memcpy(S->publish_hz, H->publish_hz, sizeof(S->publish_hz));
+        S->loop = &H->loop;
+        uint64_t floor = vtime_floor(H, NULL);
+        S->vtime = (floor == UINT64_MAX) ? 0 : floor;
+        atomic_store(&S->mode, MODE_SUMMARY);
+        atomic_store(&S->alive, 1);
+        showcase_start(S);
+        S->next_session = H->sessions;
+        H->sessions = S;
+        H->nsessions++;
+        fprintf(stderr, "Server: session %s created\n", id);
+    }
+    if (priority > 0) {
+        S->priority = (priority > HOST_MAX_PRIORITY) ? HOST_MAX_PRIORITY : (int)priority;
+    }
+    pthread_mutex_unlock(&H->mtx);
+    return S;
+}
+
+static void session_free(Server *S) {
+    showcase_stop(S);
+    job_release(S);
+    pthread_mutex_destroy(&S->clients_mtx);
+    pthread_mutex_destroy(&S->job_mtx);
+    pthread_cond_destroy(&S->job_cv);
+    free(S);
+}
+
+// A new connection's first message must name its session.
+Server *host_join(Host *H, uint32_t type, const uint8_t *payload, uint32_t len) {
+    MsgSession m;
+    if (type != MSG_SESSION || len != sizeof(m) || !atomic_load(&H->alive)) return NULL;
+    memcpy(&m, payload, sizeof(m));
+    m.session_id[sizeof(m.session_id) - 1] = '\0';
+    if (!m.session_id[0]) return NULL;
+    return session_get(H, m.session_id, m.priority);
+}
+
+// Sessions someone is watching interactively go first; among equals the one
+// with the least priority-weighted run time wins. Caller holds H->mtx.
+static Server *pick_session(Host *H) {
+    Server *best = NULL;
+    int best_class = -1;
+    for (Server *S = H->sessions; S; S = S->next_session) {
+        if (!S->runnable || S->on_cpu) continue;
+        int cls = atomic_load(&S->mode) == MODE_INTERACTIVE && server_wants(S, STREAM_STEPS);
+        if (!best || cls > best_class || (cls == best_class && S->vtime < best->vtime)) {
+            best = S;
+            best_class = cls;
+        }
+    }
+    return best;
+}
+
+static int session_restart(Server *S) {
+    MsgJob job;
+    if (!job_take(S, &job)) return 0;
+    if (!job_restart(S, &job)) {
+        fprintf(stderr, "Server: session %s rejected its job; keeping the previous one\n", S->session_id);
+        return 0;
+    }
+    sim_begin(S);
+    return 1;
+}
+
+static void *worker_thread(void *arg) {
+    Host *H = (Host*)arg;
+    pthread_mutex_lock(&H->mtx);
+    while (atomic_load(&H->alive)) {
+        Server *S = pick_session(H);
+        if (!S) {
+            pthread_cond_wait(&H->cv, &H->mtx);
+            continue;
+        }
+        S->runnable = 0;
+        S->on_cpu = 1;
+        int active = S->active;
+        pthread_mutex_unlock(&H->mtx);
+
+        uint64_t t0 = now_ns();
+        if (!active) active = session_restart(S);
+        if (active && sim_advance(S, H->slice_ms)) {
+            job_done(S);
+            active = 0;
+        }
+        uint64_t used = now_ns() - t0;
+
+        pthread_mutex_lock(&H->mtx);
+        S->vtime += used * HOST_DEFAULT_PRIORITY / (uint64_t)S->priority;
+        S->active = active;
+        S->on_cpu = 0;
+        if (active) S->runnable = 1;
+        if (S->runnable) pthread_cond_signal(&H->cv);
+    }
+    pthread_mutex_unlock(&H->mtx);
+    return NULL;
+}
+
+void host_schedule(Host *H, Server *S) {
+    pthread_mutex_lock(&H->mtx);
+    if (!S->runnable && !S->on_cpu) {
+        uint64_t floor = vtime_floor(H, S);
+        if (floor != UINT64_MAX && S->vtime < floor) S->vtime = floor;
+    }
+    S->runnable = 1;
+    pthread_cond_signal(&H->cv);
+    pthread_mutex_unlock(&H->mtx);
+}
+
+// Runs on the net loop thread, which is the only one that creates sessions,
+// attaches clients and submits jobs, so a session found idle here stays
+// idle until it is freed. A submitted job leaves its session runnable or on
+// a worker, which covers job_pending too.
+void host_reap(Host *H) {
+    Server *dead = NULL;
+    pthread_mutex_lock(&H->mtx);
+    for (Server **pp = &H->sessions; *pp;) {
+        Server *S = *pp;
+        if (S->runnable || S->on_cpu || S->active || atomic_load(&S->active_clients) > 0) {
+            pp = &S->next_session;
+            continue;
+        }
+        *pp = S->next_session;
+        S->next_session = dead;
+        dead = S;
+        H->nsessions--;
+    }
+    pthread_mutex_unlock(&H->mtx);
+
+    while (dead) {
+        Server *S = dead;
+        dead = S->next_session;
+        fprintf(stderr, "Server: session %s closed\n", S->session_id);
+        session_free(S);
+    }
+}
+
+int host_idle(Host *H) {
+    pthread_mutex_lock(&H->mtx);
+    int idle = atomic_load(&H->handshakes) == 0;
+    for (Server *S = H->sessions; S && idle; S = S->next_session) {
+        if (S->runnable || S->on_cpu || S->active || atomic_load(&S->active_clients) > 0) {
+            idle = 0;
+        }
+    }
+    pthread_mutex_unlock(&H->mtx);
+    return idle;
+}
+
+static void stop_workers(Host *H) {
+    pthread_mutex_lock(&H->mtx);
+    for (Server *S = H->sessions; S; S = S->next_session) {
+        atomic_store(&S->running, 0);
+    }
+    pthread_cond_broadcast(&H->cv);
+    pthread_mutex_unlock(&H->mtx);
+    for (int i = 0; i < H->workers; i++) {
+        pthread_join(H->worker_th[i], NULL);
+    }
+}
+
+int host_start(Host *H) {
+    pthread_mutex_init(&H->mtx, NULL);
+    pthread_cond_init(&H->cv, NULL);
+    atomic_init(&H->handshakes, 0);
+    H->listen_fd = listen_unix(H->sock_path);
+    if (H->listen_fd < 0) return 0;
+    atomic_store(&H->alive, 1);
+
+    if (H->workers <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        H->workers = (ncpu > 0) ? (int)ncpu : 1;
+    }
+    if (H->workers > HOST_MAX_WORKERS) H->workers = HOST_MAX_WORKERS;
+    if (H->slice_ms <= 0) H->slice_ms = HOST_DEFAULT_SLICE_MS;
+
+    int started = 0;
+    for (int i = 0; i < H->workers; i++) {
+        if (pthread_create(&H->worker_th[started], NULL, worker_thread, H) != 0) break;
+        started++;
+    }
+    H->workers = started;
+    if (started == 0 || !net_loop_start(&H->loop, H->listen_fd, NULL, H, H->use_uring)) {
+        atomic_store(&H->alive, 0);
+        stop_workers(H);
+        close(H->listen_fd);
+        unlink(H->sock_path);
+        return 0;
+    }
+    return 1;
+}
+
+void host_stop(Host *H) {
+    atomic_store(&H->alive, 0);
+    // The loop closes every connection, attached or not, before it returns.
+    net_loop_stop(&H->loop);
+    stop_workers(H);
+    close(H->listen_fd);
+    unlink(H->sock_path);
+
+    while (H->sessions) {
+        Server *S = H->sessions;
+        H->sessions = S->next_session;
+        if (S->active) {
+            sim_advance(S, 0);
+            job_done(S);
+        }
+        session_free(S);
+    }
+    H->nsessions = 0;
+    pthread_mutex_destroy(&H->mtx);
+    pthread_cond_destroy(&H->cv);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "server_types.h"
+#include "server_loop.h"
+
+#define HOST_MAX_WORKERS 64
+#define HOST_DEFAULT_SLICE_MS 20
+#define HOST_DEFAULT_PRIORITY 4
+#define HOST_MAX_PRIORITY 16
+#define HOST_HANDSHAKE_SECS 5
+#define HOST_DEFAULT_IDLE_SECS 300
+#define HOST_MAX_SESSIONS 64
+
+// One process, many sessions: every session is a Server without its own
+// listener or sim thread. A pool of workers runs them in slices, picking
+// sessions with watching interactive clients first and otherwise the one
+// with the least priority-weighted run time. Sessions left with no job
+// and no clients are freed again by host_reap.
+typedef struct Host {
+    char sock_path[RWALK_SOCK_MAX];
+    int listen_fd;
+    atomic_int alive;
+    atomic_int handshakes;
+
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+    Server *sessions;
+    int nsessions;
+
+    int slice_ms;
+    int history_limit;
+    OutqConfig outq;
+    int publish_hz[STREAM_COUNT];
+    int use_uring;
+    uint64_t seed;
+    int seed_fixed;
+
+    int workers;
+    pthread_t worker_th[HOST_MAX_WORKERS];
+    NetLoop loop;
+} Host;
+
+int host_start(Host *H);
+Server *host_join(Host *H, uint32_t type, const uint8_t *payload, uint32_t len);
+void host_schedule(Host *H, Server *S);
+void host_reap(Host *H);
+int host_idle(Host *H);
+void host_stop(Host *H);
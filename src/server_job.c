@@ -0,0 +1,410 @@
+#include "server_job.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server_cache.h"
+#include "server_checkpoint.h"
+#include "server_host.h"
+#include "server_net.h"
+#include "server_obstacles.h"
+
+static void free_grids(Server *S) {
+    if (S->steps_to_center) {
+        free(S->steps_to_center[0]);
+        free(S->steps_to_center);
+    }
+    if (S->succesful_replications) {
+        free(S->succesful_replications[0]);
+        free(S->succesful_replications);
+    }
+    if (S->prob_to_center) {
+        free(S->prob_to_center[0]);
+        free(S->prob_to_center);
+    }
+    if (S->avg_steps_to_center) {
+        free(S->avg_steps_to_center[0]);
+        free(S->avg_steps_to_center);
+    }
+    S->steps_to_center = NULL;
+    S->succesful_replications = NULL;
+    S->prob_to_center = NULL;
+    S->avg_steps_to_center = NULL;
+    S->alloc_w = S->alloc_h = 0;
+}
+
+static int alloc_grids(Server *S) {
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+    if (S->alloc_w == S->world_w && S->alloc_h == S->world_h) {
+        memset(S->steps_to_center[0], 0, count * sizeof(**S->steps_to_center));
+        memset(S->succesful_replications[0], 0, count * sizeof(**S->succesful_replications));
+        memset(S->prob_to_center[0], 0, count * sizeof(**S->prob_to_center));
+        memset(S->avg_steps_to_center[0], 0, count * sizeof(**S->avg_steps_to_center));
+        return 1;
+    }
+    free_grids(S);
+
+    S->steps_to_center = (uint64_t**)calloc((size_t)S->world_h, sizeof(*S->steps_to_center));
+    S->succesful_replications = (uint32_t**)calloc((size_t)S->world_h, sizeof(*S->succesful_replications));
+    S->prob_to_center = (float**)calloc((size_t)S->world_h, sizeof(*S->prob_to_center));
+    S->avg_steps_to_center = (float**)calloc((size_t)S->world_h, sizeof(*S->avg_steps_to_center));
+    if (!S->steps_to_center || !S->succesful_replications || !S->prob_to_center || !S->avg_steps_to_center) {
+        perror("steps_to_center || succesful_replications  rows alloc");
+        free_grids(S);
+        return 0;
+    }
+    S->steps_to_center[0] = (uint64_t*)calloc(count, sizeof(**S->steps_to_center));
+    S->succesful_replications[0] = (uint32_t*)calloc(count, sizeof(**S->succesful_replications));
+    S->prob_to_center[0] = (float*)calloc(count, sizeof(**S->prob_to_center));
+    S->avg_steps_to_center[0] = (float*)calloc(count, sizeof(**S->avg_steps_to_center));
+    if (!S->steps_to_center[0] || !S->succesful_replications[0] || !S->prob_to_center[0] || !S->avg_steps_to_center[0]) {
+        perror("steps_to_center || S->succesful_replicationsdata alloc");
+        free_grids(S);
+        return 0;
+    }
+    for (int y = 1; y < S->world_h; y++) {
+        S->steps_to_center[y] = S->steps_to_center[0] + (size_t)y * (size_t)S->world_w;
+        S->succesful_replications[y] = S->succesful_replications[0] + (size_t)y * (size_t)S->world_w;
+        S->prob_to_center[y] = S->prob_to_center[0] + (size_t)y * (size_t)S->world_w;
+        S->avg_steps_to_center[y] = S->avg_steps_to_center[0] + (size_t)y * (size_t)S->world_w;
+    }
+    S->alloc_w = S->world_w;
+    S->alloc_h = S->world_h;
+    return 1;
+}
+
+static int load_base_results(Server *S) {
+    ResultsMeta m;
+    uint32_t *hits = NULL;
+    uint64_t *steps = NULL;
+    if (!results_load_counts(S->base_file, &m, &hits, &steps)) {
+        fprintf(stderr, "Failed to load base results %s\n", S->base_file);
+        return 0;
+    }
+    ResultsMeta cur;
+    memset(&cur, 0, sizeof(cur));
+    cur.world_w = S->world_w;
+    cur.world_h = S->world_h;
+    cur.pU = S->pU; cur.pD = S->pD; cur.pL = S->pL; cur.pR = S->pR;
+    cur.max_steps = S->max_steps;
+    cur.obstacle_mode = S->obstacle_mode;
+    cur.obstacle_density = S->obstacle_density;
+    snprintf(cur.obstacle_file, sizeof(cur.obstacle_file), "%s", S->obstacle_file);
+    if (!results_same_config(&m, &cur)) {
+        fprintf(stderr, "Base results %s were produced with a different configuration.\n", S->base_file);
+        free(hits);
+        free(steps);
+        return 0;
+    }
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+    memcpy(S->succesful_replications[0], hits, count * sizeof(*hits));
+    memcpy(S->steps_to_center[0], steps, count * sizeof(*steps));
+    S->base_replications = m.replications;
+    free(hits);
+    free(steps);
+    return 1;
+}
+
+int job_validate(const MsgJob *j) {
+    float psum = j->pU + j->pD + j->pL + j->pR;
+    if (j->step_delay_ms < 0 || (psum < 0.999f || psum > 1.001f)) {
+        fprintf(stderr, "Invalid args (delay>=0, probabilities sum ~ 1).\n");
+        return 0;
+    }
+    if (j->obstacle_mode != 2 && (j->world_w <= 2 || j->world_h <= 2)) {
+        fprintf(stderr, "Invalid args (world sizes >2).\n");
+        return 0;
+    }
+    if (j->replications <= 0 || j->max_steps <= 0) {
+        fprintf(stderr, "replications and max_steps must be > 0\n");
+        return 0;
+    }
+    if (j->budget_secs < 0) {
+        fprintf(stderr, "budget_secs must be >= 0\n");
+        return 0;
+    }
+    if (j->obstacle_mode < 0 || j->obstacle_mode > 2) {
+        fprintf(stderr, "obstacle_mode must be 0, 1, or 2\n");
+        return 0;
+    }
+    if (j->obstacle_mode == 2 && j->obstacle_file[0] == '\0') {
+        fprintf(stderr, "obstacle_file is required when obstacle_mode=2\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Frees what a staged job built for itself; a kept map belongs to S.
+static void stage_free(Server *T, const Server *S) {
+    if (T->obstacles != S->obstacles) free(T->obstacles);
+    free_grids(T);
+    rwalk_world_free(T->walk);
+    history_free(&T->history);
+}
+
+// Builds everything for job j in the zeroed scratch server T. Nothing in S
+// changes, so a failed step leaves the previous job as it was.
+static int stage_job(Server *T, Server *S, const MsgJob *j, const char *resume_path) {
+    int keep_obstacles = S->obstacles && j->obstacle_mode == 1 && S->obstacle_mode == 1 &&
+                         S->world_w == j->world_w && S->world_h == j->world_h &&
+                         S->obstacle_density == j->obstacle_density;
+
+    T->world_w = j->world_w;
+    T->world_h = j->world_h;
+    T->step_delay_ms = j->step_delay_ms;
+    T->replications = j->replications;
+    T->max_steps = j->max_steps;
+    T->pU = j->pU; T->pD = j->pD; T->pL = j->pL; T->pR = j->pR;
+    T->base_replications = (j->base_replications > 0) ? j->base_replications : 0;
+    T->budget_secs = j->budget_secs;
+    T->obstacle_mode = j->obstacle_mode;
+    T->obstacle_density = (j->obstacle_mode != 0) ? j->obstacle_density : 0.0f;
+    snprintf(T->obstacle_file, sizeof(T->obstacle_file), "%s",
+             (j->obstacle_mode == 2) ? j->obstacle_file : "");
+    snprintf(T->results_path, sizeof(T->results_path), "%s", j->results_path);
+    snprintf(T->base_file, sizeof(T->base_file), "%s", j->base_file);
+    T->seed = S->seed;
+    if (!S->seed_fixed && S->jobs > 0) {
+        T->seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32) ^
+                  ((uint64_t)S->jobs * 0x9E3779B97F4A7C15ull);
+    }
+
+    if (keep_obstacles) {
+        T->obstacles = S->obstacles;
+    } else if (!init_obstacles(T)) {
+        fprintf(stderr,"Obstacle init fail.\n");
+        fflush(stderr);
+        return 0;
+    }
+    if (T->world_w <= 2 || T->world_h <= 2) {
+        fprintf(stderr, "Invalid world size (must be > 2).\n");
+        return 0;
+    }
+    if (!alloc_grids(T)) return 0;
+
+    int history_window = S->history_limit;
+    if (history_window > T->max_steps + 1) history_window = T->max_steps + 1;
+    if (!history_resize(&T->history, history_window)) {
+        perror("history alloc");
+        return 0;
+    }
+
+    if (T->base_file[0] && !load_base_results(T)) {
+        return 0;
+    }
+    if (resume_path && *resume_path && !checkpoint_resume(T, resume_path)) {
+        return 0;
+    }
+
+    // The world borrows the map, so it is built after a resume replaced it.
+    T->walk = rwalk_world_create(T->world_w, T->world_h, T->max_steps,
+                                 T->pU, T->pD, T->pL, T->pR);
+    if (!T->walk) {
+        fprintf(stderr, "Failed to create the walk world.\n");
+        return 0;
+    }
+    rwalk_world_set_obstacles(T->walk, T->obstacles);
+
+    // The writers only serve the job that runs next; the previous one has
+    // already written its results.
+    size_t count = (size_t)T->world_w * (size_t)T->world_h;
+    if (!results_writer_reset(&S->writer, T->results_path, count, NULL, NULL)) {
+        perror("results writer");
+        return 0;
+    }
+    if (S->checkpoint_path[0] &&
+        !results_writer_reset(&S->checkpoint, S->checkpoint_path, count,
+                              checkpoint_write, T->obstacles)) {
+        perror("checkpoint writer");
+        return 0;
+    }
+    return 1;
+}
+
+// Swaps the staged job into S, freeing what the previous job held.
+static void commit_job(Server *S, Server *T) {
+    // A snapshot from the interrupted job may still be writing the old map.
+    results_writer_drain(&S->checkpoint);
+    if (S->obstacles != T->obstacles) free(S->obstacles);
+    S->obstacles = T->obstacles;
+    free_grids(S);
+    S->steps_to_center = T->steps_to_center;
+    S->succesful_replications = T->succesful_replications;
+    S->prob_to_center = T->prob_to_center;
+    S->avg_steps_to_center = T->avg_steps_to_center;
+    S->alloc_w = T->alloc_w;
+    S->alloc_h = T->alloc_h;
+    rwalk_world_free(S->walk);
+    S->walk = T->walk;
+    history_free(&S->history);
+    memcpy(&S->history, &T->history, sizeof(S->history));
+
+    S->world_w = T->world_w;
+    S->world_h = T->world_h;
+    S->step_delay_ms = T->step_delay_ms;
+    S->replications = T->replications;
+    S->max_steps = T->max_steps;
+    S->pU = T->pU; S->pD = T->pD; S->pL = T->pL; S->pR = T->pR;
+    S->base_replications = T->base_replications;
+    S->budget_secs = T->budget_secs;
+    S->obstacle_mode = T->obstacle_mode;
+    S->obstacle_density = T->obstacle_density;
+    memcpy(S->obstacle_file, T->obstacle_file, sizeof(S->obstacle_file));
+    memcpy(S->results_path, T->results_path, sizeof(S->results_path));
+    memcpy(S->base_file, T->base_file, sizeof(S->base_file));
+    S->seed = T->seed;
+    S->rng = T->rng;
+    S->resume = T->resume;
+    S->resuming = T->resuming;
+    S->jobs++;
+}
+
+// The job is staged next to the current one and swapped in only once every
+// step that can fail has succeeded, so a rejected job leaves the previous
+// one in place. Random maps are kept when the next job asks for the same
+// world, so the generator and its reachability repair only run when
+// something changed.
+int job_apply(Server *S, const MsgJob *j, const char *resume_path) {
+    FILE *results_fp = fopen(j->results_path, "a");
+    if (!results_fp) {
+        perror(j->results_path);
+        return 0;
+    }
+    fclose(results_fp);
+
+    Server *T = (Server*)calloc(1, sizeof(*T));
+    if (!T) {
+        perror("job");
+        return 0;
+    }
+    if (!stage_job(T, S, j, resume_path)) {
+        stage_free(T, S);
+        free(T);
+        return 0;
+    }
+    commit_job(S, T);
+    free(T);
+
+    MsgStep start = { .x = S->world_w / 2, .y = S->world_h / 2, .step_index = 0 };
+    history_begin(&S->history, start);
+
+    cache_prepare(S, S->seed_fixed);
+    // Continuing from a base file or the cache draws the stream after the
+    // replications it already holds, as the shards do, not a replay of them.
+    if (!S->resuming) {
+        rng_seed(&S->rng, S->seed, (uint64_t)(S->base_replications + S->cached_replications));
+    }
+
+    atomic_store(&S->current_replication, S->cached_replications);
+    atomic_store(&S->current_step, 0);
+    atomic_store(&S->completed, 0);
+    return 1;
+}
+
+void job_submit(Server *S, const MsgJob *j) {
+    pthread_mutex_lock(&S->job_mtx);
+    S->pending_job = *j;
+    S->job_pending = 1;
+    atomic_store(&S->running, 0);
+    pthread_cond_broadcast(&S->job_cv);
+    pthread_mutex_unlock(&S->job_mtx);
+    if (S->host) host_schedule(S->host, S);
+}
+
+int job_take(Server *S, MsgJob *out) {
+    pthread_mutex_lock(&S->job_mtx);
+    int got = S->job_pending;
+    if (got) {
+        *out = S->pending_job;
+        S->job_pending = 0;
+    }
+    pthread_mutex_unlock(&S->job_mtx);
+    return got;
+}
+
+int job_wait(Server *S, MsgJob *out) {
+    pthread_mutex_lock(&S->job_mtx);
+    while (!S->job_pending && atomic_load(&S->alive)) {
+        pthread_cond_wait(&S->job_cv, &S->job_mtx);
+    }
+    int got = S->job_pending && atomic_load(&S->alive);
+    if (got) {
+        *out = S->pending_job;
+        S->job_pending = 0;
+    }
+    pthread_mutex_unlock(&S->job_mtx);
+    return got;
+}
+
+// The job is built with the locks released, so a slow map or base file
+// does not stall the net loop; until it is greeted in, the walker idles
+// and new clients wait for the greeting below.
+int job_restart(Server *S, const MsgJob *j) {
+    pthread_mutex_lock(&S->showcase_mtx);
+    pthread_mutex_lock(&S->clients_mtx);
+    S->restarting = 1;
+    pthread_mutex_unlock(&S->clients_mtx);
+    pthread_mutex_unlock(&S->showcase_mtx);
+
+    int ok = job_apply(S, j, NULL);
+    if (!ok) {
+        static const char msg[] = "Job rejected; the previous job is kept.";
+        clients_broadcast(S, MSG_ERROR, msg, (uint32_t)(sizeof(msg) - 1));
+    }
+
+    pthread_mutex_lock(&S->showcase_mtx);
+    pthread_mutex_lock(&S->clients_mtx);
+    S->restarting = 0;
+    if (ok) {
+        if (j->mode == MODE_INTERACTIVE || j->mode == MODE_SUMMARY) {
+            atomic_store(&S->mode, j->mode);
+        }
+        atomic_store(&S->running, 1);
+    }
+    // On failure the previous job stays; clients that came in meanwhile
+    // still need it.
+    if (S->jobs > 0) clients_greet_all(S);
+    pthread_mutex_unlock(&S->clients_mtx);
+    pthread_mutex_unlock(&S->showcase_mtx);
+    return ok;
+}
+
+void job_done(Server *S) {
+    if (S->checkpoint_path[0] && atomic_load(&S->completed)) {
+        results_writer_drain(&S->checkpoint);
+        unlink(S->checkpoint_path);
+    }
+}
+
+int job_idle(Server *S) {
+    pthread_mutex_lock(&S->job_mtx);
+    int idle = !S->job_pending && !atomic_load(&S->running) &&
+               atomic_load(&S->active_clients) == 0;
+    pthread_mutex_unlock(&S->job_mtx);
+    return idle;
+}
+
+void job_wake(Server *S) {
+    pthread_mutex_lock(&S->job_mtx);
+    pthread_cond_broadcast(&S->job_cv);
+    pthread_mutex_unlock(&S->job_mtx);
+}
+
+void job_release(Server *S) {
+    results_writer_finish(&S->writer);
+    cache_finish(S);
+    results_writer_finish(&S->checkpoint);
+    free_grids(S);
+    free(S->round_hits);
+    free(S->round_steps);
+    S->round_hits = NULL;
+    S->round_steps = NULL;
+    rwalk_world_free(S->walk);
+    S->walk = NULL;
+    free(S->obstacles);
+    S->obstacles = NULL;
+    history_free(&S->history);
+}
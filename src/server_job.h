@@ -0,0 +1,16 @@
+#pragma once
+
+#include "server_types.h"
+
+#define JOB_DEFAULT_IDLE_SECS 0
+
+int job_validate(const MsgJob *j);
+int job_apply(Server *S, const MsgJob *j, const char *resume_path);
+void job_submit(Server *S, const MsgJob *j);
+int job_take(Server *S, MsgJob *out);
+int job_wait(Server *S, MsgJob *out);
+int job_restart(Server *S, const MsgJob *j);
+void job_done(Server *S);
+int job_idle(Server *S);
+void job_wake(Server *S);
+void job_release(Server *S);
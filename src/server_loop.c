@@ -0,0 +1,537 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "server_loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "server_host.h"
+#include "server_net.h"
+
+// io_uring completions carry a client pointer, tagged for sends, or one
+// of these small constants.
+#define LOOP_UD_WAKE 1u
+#define LOOP_UD_LISTEN 2u
+#define LOOP_UD_SEND 1u
+
+static int loop_ctl(NetLoop *L, int op, int fd, void *ptr, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.ptr = ptr };
+    return epoll_ctl(L->epfd, op, fd, &ev);
+}
+
+static Client *client_new(int fd) {
+    Client *c = (Client*)calloc(1, sizeof(Client));
+    if (!c) return NULL;
+    if (!outq_init(&c->q)) {
+        free(c);
+        return NULL;
+    }
+    c->fd = fd;
+    c->slab = -1;
+    atomic_init(&c->kicked, 0);
+    clock_gettime(CLOCK_MONOTONIC, &c->since);
+    return c;
+}
+
+static void slab_release(NetLoop *L, Client *c) {
+    L->slab_free |= 1ull << c->slab;
+    c->slab = -1;
+    c->slab_len = c->slab_off = 0;
+}
+
+// Connections are detached at once but freed from the graveyard, after
+// the current batch of events and once no ring op still points at them.
+static void loop_close(NetLoop *L, Client *c) {
+    if (c->closed) return;
+    c->closed = 1;
+    if (c->S) {
+        client_detach(c->S, c);
+    } else if (L->host) {
+        atomic_fetch_sub(&L->host->handshakes, 1);
+    }
+    // Detached clients get no new kicks; drop a pending one.
+    pthread_mutex_lock(&L->kick_mtx);
+    for (Client **pp = &L->kicked; *pp; pp = &(*pp)->kick_next) {
+        if (*pp == c) {
+            *pp = c->kick_next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&L->kick_mtx);
+
+    if (c->conn_prev) c->conn_prev->conn_next = c->conn_next;
+    else L->conns = c->conn_next;
+    if (c->conn_next) c->conn_next->conn_prev = c->conn_prev;
+    // Completes any receive or send still queued on the ring.
+    shutdown(c->fd, SHUT_RDWR);
+    c->conn_next = L->graveyard;
+    L->graveyard = c;
+}
+
+static void loop_bury(NetLoop *L) {
+    Client **pp = &L->graveyard;
+    while (*pp) {
+        Client *c = *pp;
+        if (c->ops > 0) {
+            pp = &c->conn_next;
+            continue;
+        }
+        *pp = c->conn_next;
+        close(c->fd);
+        if (c->q.dropped) {
+            fprintf(stderr, "Server: client fell behind; %llu frames dropped\n",
+                    (unsigned long long)c->q.dropped);
+        }
+        if (c->slab >= 0) slab_release(L, c);
+        frame_unref(c->out);
+        outq_free(&c->q);
+        free(c);
+    }
+}
+
+static void ring_recv(NetLoop *L, Client *c, size_t need);
+
+static void loop_accept(NetLoop *L) {
+    // Ring ops on a non-blocking socket fail with EAGAIN instead of
+    // waiting in the kernel.
+    int flags = SOCK_CLOEXEC | (L->use_ring ? 0 : SOCK_NONBLOCK);
+    for (;;) {
+        int fd = accept4(L->listen_fd, NULL, NULL, flags);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        Client *c = client_new(fd);
+        if (!c || (!L->use_ring && loop_ctl(L, EPOLL_CTL_ADD, fd, c, EPOLLIN) != 0)) {
+            if (c) outq_free(&c->q);
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->conn_next = L->conns;
+        if (L->conns) L->conns->conn_prev = c;
+        L->conns = c;
+        if (L->host) {
+            atomic_fetch_add(&L->host->handshakes, 1);
+        } else {
+            server_accept(L->server, c);
+        }
+        if (L->use_ring) ring_recv(L, c, sizeof(MsgHdr));
+    }
+}
+
+// Host connections start with a session message; everything after goes to
+// that session. Returns 0 to close the connection.
+static int loop_dispatch(NetLoop *L, Client *c, const MsgHdr *h, const uint8_t *payload) {
+    if (c->S) return client_message(c->S, c, h->type, payload, h->len);
+    Server *S = host_join(L->host, h->type, payload, h->len);
+    if (!S) return 0;
+    atomic_fetch_sub(&L->host->handshakes, 1);
+    client_attach(S, c);
+    return 1;
+}
+
+// Dispatches a complete message in c->in, if there is one, and reports how
+// many bytes the next one still needs. Returns 0 to close the connection.
+static int loop_parse(NetLoop *L, Client *c, size_t *need) {
+    for (;;) {
+        size_t want = sizeof(MsgHdr);
+        MsgHdr h;
+        if (c->in_len >= sizeof(h)) {
+            memcpy(&h, c->in, sizeof(h));
+            if (h.len > CLIENT_MAX_MSG) return 0;
+            want += h.len;
+        }
+        if (c->in_len < want) {
+            *need = want - c->in_len;
+            return 1;
+        }
+        c->in_len = 0;
+        if (!loop_dispatch(L, c, &h, c->in + sizeof(h))) return 0;
+    }
+}
+
+static int loop_read(NetLoop *L, Client *c) {
+    size_t need;
+    while (loop_parse(L, c, &need)) {
+        ssize_t r = recv(c->fd, c->in + c->in_len, need, 0);
+        if (r > 0) {
+            c->in_len += (uint32_t)r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR) continue;
+        return r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return 0;
+}
+
+// Writes queued frames until the socket is full, then waits for EPOLLOUT
+// with the rest of a partly written frame held in c->out.
+static int loop_flush(NetLoop *L, Client *c) {
+    for (;;) {
+        if (!c->out) {
+            int got = outq_take(&c->q, SIZE_MAX, &c->out);
+            if (got < 0) return 0;
+            if (got == 0) break;
+            c->out_off = 0;
+        }
+        ssize_t w = send(c->fd, c->out->data + c->out_off, c->out->size - c->out_off,
+                         MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return 0;
+            if (!c->want_out) {
+                c->want_out = 1;
+                loop_ctl(L, EPOLL_CTL_MOD, c->fd, c, EPOLLIN | EPOLLOUT);
+            }
+            return 1;
+        }
+        c->out_off += (size_t)w;
+        if (c->out_off == c->out->size) {
+            frame_unref(c->out);
+            c->out = NULL;
+        }
+    }
+    if (c->want_out) {
+        c->want_out = 0;
+        loop_ctl(L, EPOLL_CTL_MOD, c->fd, c, EPOLLIN);
+    }
+    return 1;
+}
+
+static Client *loop_take_kicked(NetLoop *L) {
+    pthread_mutex_lock(&L->kick_mtx);
+    Client *list = L->kicked;
+    L->kicked = NULL;
+    for (Client *c = list; c; c = c->kick_next) atomic_store(&c->kicked, 0);
+    pthread_mutex_unlock(&L->kick_mtx);
+    return list;
+}
+
+static void loop_tick(NetLoop *L, struct timespec *last_tick) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (L->host && now.tv_sec != last_tick->tv_sec) {
+        if (atomic_load(&L->host->handshakes) > 0) {
+            for (Client *c = L->conns, *next; c; c = next) {
+                next = c->conn_next;
+                if (!c->S && now.tv_sec - c->since.tv_sec >= HOST_HANDSHAKE_SECS) loop_close(L, c);
+            }
+            loop_bury(L);
+        }
+        host_reap(L->host);
+    }
+    *last_tick = now;
+}
+
+static void epoll_loop(NetLoop *L) {
+    struct epoll_event evs[LOOP_MAX_EVENTS];
+    struct timespec last_tick;
+    clock_gettime(CLOCK_MONOTONIC, &last_tick);
+
+    while (!atomic_load(&L->stop)) {
+        int n = epoll_wait(L->epfd, evs, LOOP_MAX_EVENTS, LOOP_TICK_MS);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *p = evs[i].data.ptr;
+            if (p == &L->listen_fd) {
+                loop_accept(L);
+                continue;
+            }
+            if (p == &L->wake_fd) {
+                while (read(L->wake_fd, &L->wake_buf, sizeof(L->wake_buf)) < 0 && errno == EINTR) {}
+                for (Client *c = loop_take_kicked(L), *next; c; c = next) {
+                    next = c->kick_next;
+                    if (!c->closed && !c->want_out && !loop_flush(L, c)) loop_close(L, c);
+                }
+                continue;
+            }
+            Client *c = (Client*)p;
+            if (c->closed) continue;
+            int ok = 1;
+            if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ok = loop_read(L, c);
+            if (ok && !c->closed && (evs[i].events & EPOLLOUT)) ok = loop_flush(L, c);
+            if (!ok) loop_close(L, c);
+        }
+        loop_bury(L);
+        loop_tick(L, &last_tick);
+    }
+
+    while (L->conns) loop_close(L, L->conns);
+    loop_bury(L);
+}
+
+// The io_uring backend. One pass over the completion queue can queue many
+// receives and sends; they all reach the kernel in the next io_uring_enter,
+// which also waits for more completions.
+
+static struct io_uring_sqe *ring_sqe(NetLoop *L) {
+    struct io_uring_sqe *sqe;
+    while (!(sqe = uring_sqe(&L->ring))) uring_submit(&L->ring, 0, -1);
+    return sqe;
+}
+
+static void ring_arm_wake(NetLoop *L) {
+    struct io_uring_sqe *sqe = ring_sqe(L);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = L->wake_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&L->wake_buf;
+    sqe->len = sizeof(L->wake_buf);
+    sqe->user_data = LOOP_UD_WAKE;
+}
+
+static void ring_arm_listen(NetLoop *L) {
+    struct io_uring_sqe *sqe = ring_sqe(L);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = L->listen_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = LOOP_UD_LISTEN;
+}
+
+static void ring_recv(NetLoop *L, Client *c, size_t need) {
+    struct io_uring_sqe *sqe = ring_sqe(L);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(c->in + c->in_len);
+    sqe->len = (uint32_t)need;
+    sqe->user_data = (uint64_t)(uintptr_t)c;
+    c->ops++;
+}
+
+// Small frames are packed back to back into a registered slab and go out
+// as one fixed-buffer write. A frame too big for a slab, or one that finds
+// none free, is sent straight from its own memory.
+static void ring_send(NetLoop *L, Client *c) {
+    if (c->sending || c->closed) return;
+    if (c->slab < 0 && !c->out) {
+        int got = 0;
+        Frame *f;
+        while (L->slab_free &&
+               (got = outq_take(&c->q, LOOP_SLAB_BYTES - c->slab_len, &f)) > 0) {
+            if (c->slab < 0) {
+                c->slab = __builtin_ctzll(L->slab_free);
+                L->slab_free &= ~(1ull << c->slab);
+            }
+            memcpy(L->slabs + (size_t)c->slab * LOOP_SLAB_BYTES + c->slab_len, f->data, f->size);
+            c->slab_len += (uint32_t)f->size;
+            frame_unref(f);
+        }
+        if (c->slab < 0) {
+            if (got >= 0) got = outq_take(&c->q, SIZE_MAX, &c->out);
+            if (got < 0) {
+                loop_close(L, c);
+                return;
+            }
+            if (got == 0) return;
+            c->out_off = 0;
+        }
+    }
+
+    struct io_uring_sqe *sqe = ring_sqe(L);
+    sqe->fd = c->fd;
+    if (c->slab >= 0 && L->fixed) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = (uint16_t)c->slab;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    if (c->slab >= 0) {
+        sqe->addr = (uint64_t)(uintptr_t)(L->slabs + (size_t)c->slab * LOOP_SLAB_BYTES + c->slab_off);
+        sqe->len = c->slab_len - c->slab_off;
+    } else {
+        sqe->addr = (uint64_t)(uintptr_t)(c->out->data + c->out_off);
+        sqe->len = (uint32_t)(c->out->size - c->out_off);
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)c | LOOP_UD_SEND;
+    c->ops++;
+    c->sending = 1;
+}
+
+static void ring_sent(NetLoop *L, Client *c, int res) {
+    c->ops--;
+    c->sending = 0;
+    if (c->closed) return;
+    if (res < 0 && res != -EINTR && res != -EAGAIN) {
+        loop_close(L, c);
+        return;
+    }
+    if (res > 0 && c->slab >= 0) {
+        c->slab_off += (uint32_t)res;
+        if (c->slab_off == c->slab_len) slab_release(L, c);
+    } else if (res > 0) {
+        c->out_off += (size_t)res;
+        if (c->out_off == c->out->size) {
+            frame_unref(c->out);
+            c->out = NULL;
+        }
+    }
+    ring_send(L, c);
+}
+
+static void ring_received(NetLoop *L, Client *c, int res) {
+    c->ops--;
+    if (c->closed) return;
+    int retry = (res == -EINTR || res == -EAGAIN);
+    size_t need;
+    if (res > 0) c->in_len += (uint32_t)res;
+    if ((res <= 0 && !retry) || !loop_parse(L, c, &need)) {
+        loop_close(L, c);
+        return;
+    }
+    ring_recv(L, c, need);
+}
+
+static void ring_complete(NetLoop *L, const struct io_uring_cqe *cqe) {
+    if (cqe->user_data == LOOP_UD_WAKE) {
+        for (Client *c = loop_take_kicked(L), *next; c; c = next) {
+            next = c->kick_next;
+            ring_send(L, c);
+        }
+        ring_arm_wake(L);
+    } else if (cqe->user_data == LOOP_UD_LISTEN) {
+        loop_accept(L);
+        ring_arm_listen(L);
+    } else if (cqe->user_data & LOOP_UD_SEND) {
+        ring_sent(L, (Client*)(uintptr_t)(cqe->user_data & ~(uint64_t)LOOP_UD_SEND), cqe->res);
+    } else {
+        ring_received(L, (Client*)(uintptr_t)cqe->user_data, cqe->res);
+    }
+}
+
+static void ring_loop(NetLoop *L) {
+    struct timespec last_tick;
+    clock_gettime(CLOCK_MONOTONIC, &last_tick);
+    ring_arm_wake(L);
+    ring_arm_listen(L);
+
+    while (!atomic_load(&L->stop)) {
+        if (uring_submit(&L->ring, 1, LOOP_TICK_MS) != 0) {
+            perror("io_uring_enter");
+            break;
+        }
+        struct io_uring_cqe cqe;
+        while (uring_reap(&L->ring, &cqe)) ring_complete(L, &cqe);
+        loop_bury(L);
+        loop_tick(L, &last_tick);
+    }
+
+    // Shutting the sockets down completes their ops; wait for all of them.
+    while (L->conns) loop_close(L, L->conns);
+    loop_bury(L);
+    while (L->graveyard) {
+        if (uring_submit(&L->ring, 1, LOOP_TICK_MS) != 0) break;
+        struct io_uring_cqe cqe;
+        while (uring_reap(&L->ring, &cqe)) {
+            uint64_t ud = cqe.user_data;
+            if (ud == LOOP_UD_WAKE || ud == LOOP_UD_LISTEN) continue;
+            ((Client*)(uintptr_t)(ud & ~(uint64_t)LOOP_UD_SEND))->ops--;
+        }
+        loop_bury(L);
+    }
+}
+
+static int ring_setup(NetLoop *L) {
+    if (!uring_init(&L->ring, LOOP_RING_ENTRIES)) return 0;
+    L->slabs = mmap(NULL, (size_t)LOOP_SLABS * LOOP_SLAB_BYTES, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (L->slabs == MAP_FAILED) {
+        L->slabs = NULL;
+        uring_free(&L->ring);
+        return 0;
+    }
+    struct iovec iov[LOOP_SLABS];
+    for (int i = 0; i < LOOP_SLABS; i++) {
+        iov[i].iov_base = L->slabs + (size_t)i * LOOP_SLAB_BYTES;
+        iov[i].iov_len = LOOP_SLAB_BYTES;
+    }
+    L->fixed = uring_register_buffers(&L->ring, iov, LOOP_SLABS);
+    if (!L->fixed) perror("io_uring buffers not registered");
+    L->slab_free = (1ull << LOOP_SLABS) - 1u;
+    return 1;
+}
+
+static void *loop_thread(void *arg) {
+    NetLoop *L = (NetLoop*)arg;
+    if (L->use_ring) {
+        ring_loop(L);
+    } else {
+        epoll_loop(L);
+    }
+    return NULL;
+}
+
+void net_loop_kick(NetLoop *L, Client *c) {
+    if (atomic_exchange(&c->kicked, 1)) return;
+    pthread_mutex_lock(&L->kick_mtx);
+    int first = (L->kicked == NULL);
+    c->kick_next = L->kicked;
+    L->kicked = c;
+    pthread_mutex_unlock(&L->kick_mtx);
+    if (first) {
+        uint64_t one = 1;
+        while (write(L->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    }
+}
+
+static void net_loop_release(NetLoop *L) {
+    if (L->epfd >= 0) close(L->epfd);
+    if (L->wake_fd >= 0) close(L->wake_fd);
+    if (L->use_ring) uring_free(&L->ring);
+    if (L->slabs) munmap(L->slabs, (size_t)LOOP_SLABS * LOOP_SLAB_BYTES);
+    pthread_mutex_destroy(&L->kick_mtx);
+}
+
+// With use_ring, falls back to epoll when io_uring cannot be set up.
+int net_loop_start(NetLoop *L, int listen_fd, Server *S, struct Host *H, int use_ring) {
+    memset(L, 0, sizeof(*L));
+    L->listen_fd = listen_fd;
+    L->server = S;
+    L->host = H;
+    L->epfd = -1;
+    pthread_mutex_init(&L->kick_mtx, NULL);
+    if (use_ring) {
+        L->use_ring = ring_setup(L);
+        if (!L->use_ring) perror("io_uring unavailable, using epoll");
+    }
+    // The wake eventfd stays blocking so a ring read on it waits.
+    L->wake_fd = eventfd(0, EFD_CLOEXEC);
+    int ok = L->wake_fd >= 0 &&
+             fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK) == 0;
+    if (ok && !L->use_ring) {
+        L->epfd = epoll_create1(EPOLL_CLOEXEC);
+        ok = L->epfd >= 0 &&
+             loop_ctl(L, EPOLL_CTL_ADD, listen_fd, &L->listen_fd, EPOLLIN) == 0 &&
+             loop_ctl(L, EPOLL_CTL_ADD, L->wake_fd, &L->wake_fd, EPOLLIN) == 0;
+    }
+    if (!ok || pthread_create(&L->th, NULL, loop_thread, L) != 0) {
+        perror("net loop");
+        net_loop_release(L);
+        return 0;
+    }
+    return 1;
+}
+
+// Joins the loop thread, which closes every connection on its way out.
+void net_loop_stop(NetLoop *L) {
+    atomic_store(&L->stop, 1);
+    uint64_t one = 1;
+    while (write(L->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    pthread_join(L->th, NULL);
+    net_loop_release(L);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "server_types.h"
+#include "uring.h"
+
+#define LOOP_MAX_EVENTS 64
+#define LOOP_TICK_MS 1000
+#define LOOP_RING_ENTRIES 256
+#define LOOP_SLABS 32
+#define LOOP_SLAB_BYTES 65536
+
+// One thread owns every client socket: accepts, reads and writes are
+// driven by epoll, or by io_uring when use_ring is set. Broadcasters queue
+// frames and kick the loop through an eventfd. With a host, new
+// connections name their session before they are attached; otherwise
+// they join server directly.
+typedef struct NetLoop {
+    int epfd;
+    int wake_fd;
+    int listen_fd;
+    Server *server;
+    struct Host *host;
+    pthread_t th;
+    atomic_int stop;
+    pthread_mutex_t kick_mtx;
+    Client *kicked;
+    Client *conns;
+    Client *graveyard;
+    int use_ring;
+    Uring ring;
+    uint8_t *slabs;     // LOOP_SLABS send buffers, registered when fixed
+    int fixed;
+    uint64_t slab_free; // bit per free slab
+    uint64_t wake_buf;
+} NetLoop;
+
+int net_loop_start(NetLoop *L, int listen_fd, Server *S, struct Host *H, int use_ring);
+void net_loop_kick(NetLoop *L, Client *c);
+void net_loop_stop(NetLoop *L);
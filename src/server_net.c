@@ -4,15 +4,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
 #include "protocol.h"
 #include "server_sim.h"
+#include "server_obstacles.h"
+#include "server_job.h"
+#include "server_host.h"
+#include "server_loop.h"
+#include "step_batch.h"
 
-static void send_welcome(Server *S, int fd) {
-    MsgWelcome w = {
+void server_welcome(Server *S, MsgWelcome *out) {
+    *out = (MsgWelcome){
         .world_w = (uint32_t)S->world_w,
         .world_h = (uint32_t)S->world_h,
         .step_delay_ms = (uint32_t)S->step_delay_ms,
@@ -21,205 +27,339 @@ static void send_welcome(Server *S, int fd) {
         .mode = atomic_load(&S->mode),
         .pU = S->pU, .pD = S->pD, .pL = S->pL, .pR = S->pR
     };
-    MsgHdr h = { MSG_WELCOME, (uint32_t)sizeof(w) };
-    (void)send_all(fd, &h, sizeof(h));
-    (void)send_all(fd, &w, sizeof(w));
 }
 
-static void send_progress(Server *S, int fd) {
+// Greeting frames are queued with force so a full queue cannot drop them.
+static void greet_push(Server *S, Client *c, Frame *f) {
+    if (!f) return;
+    outq_push(&c->q, &S->outq, f, 1);
+    if (S->loop) net_loop_kick(S->loop, c);
+    frame_unref(f);
+}
+
+static void send_welcome(Server *S, Client *c) {
+    MsgWelcome w;
+    server_welcome(S, &w);
+    greet_push(S, c, frame_new(MSG_WELCOME, &w, (uint32_t)sizeof(w)));
+}
+
+static void send_progress(Server *S, Client *c) {
     MsgProgress p = {
         .current_replication = (uint32_t)atomic_load(&S->current_replication),
         .total_replications = (uint32_t)S->replications
     };
-    MsgHdr h = { MSG_PROGRESS, (uint32_t)sizeof(p) };
-    (void)send_all(fd, &h, sizeof(h));
-    (void)send_all(fd, &p, sizeof(p));
-}
-
-static void send_initial_step(Server *S, int fd) {
-    MsgStep st = {
-        .x = S->world_w / 2,
-        .y = S->world_h / 2,
-        .step_index = 0
-    };
-    MsgHdr h = { MSG_STEP, (uint32_t)sizeof(st) };
-    (void)send_all(fd, &h, sizeof(h));
-    (void)send_all(fd, &st, sizeof(st));
+    greet_push(S, c, frame_new(MSG_PROGRESS, &p, (uint32_t)sizeof(p)));
 }
 
-static void send_history(Server *S, int fd) {
-    int count = 0;
+// The whole history goes out as one frame of back-to-back step runs,
+// each starting afresh; with no history yet, the walk starts at the centre.
+static void send_history(Server *S, Client *c) {
     MsgStep *tmp = NULL;
+    int count = history_snapshot(&S->history, S->world_w, S->world_h, S->obstacles, &tmp);
+    MsgStep centre = { .x = S->world_w / 2, .y = S->world_h / 2, .step_index = 0 };
+    const MsgStep *steps = tmp ? tmp : &centre;
+    if (!tmp) count = 1;
 
-    pthread_mutex_lock(&S->hist_mtx);
-    int current = atomic_load(&S->current_step);
-    if (current < 0) current = 0;
-    if (current >= S->history_cap) current = S->history_cap - 1;
-    count = current + 1;
-    if (count > 0) {
-        tmp = (MsgStep*)malloc((size_t)count * sizeof(*tmp));
-        if (tmp) {
-            memcpy(tmp, S->history, (size_t)count * sizeof(*tmp));
-        }
+    size_t bytes = 0;
+    for (int i = 0, r; i < count; i += r) {
+        r = steps_run(steps + i, count - i, S->world_w, S->world_h);
+        bytes += sizeof(MsgHdr) + STEPS_PAYLOAD_MAX((size_t)r - 1u);
     }
-    pthread_mutex_unlock(&S->hist_mtx);
-
-    if (!tmp) {
-        send_initial_step(S, fd);
-        return;
-    }
-
-    for (int i = 0; i < count; i++) {
-        MsgHdr h = { MSG_STEP, (uint32_t)sizeof(tmp[i]) };
-        (void)send_all(fd, &h, sizeof(h));
-        (void)send_all(fd, &tmp[i], sizeof(tmp[i]));
+    Frame *f = frame_alloc(MSG_STEPS, bytes);
+    if (f) {
+        uint8_t *p = f->data;
+        for (int i = 0, r; i < count; i += r) {
+            r = steps_run(steps + i, count - i, S->world_w, S->world_h);
+            uint32_t len = steps_encode(steps + i, r, 1, S->world_w, S->world_h, p + sizeof(MsgHdr));
+            MsgHdr h = { MSG_STEPS, len };
+            memcpy(p, &h, sizeof(h));
+            p += sizeof(h) + len;
+        }
+        f->size = (size_t)(p - f->data);
     }
+    greet_push(S, c, f);
     free(tmp);
 }
 
-static void send_obstacles(Server *S, int fd) {
+static void send_obstacles(Server *S, Client *c) {
     if (!S->obstacles) return;
     size_t count = (size_t)S->world_w * (size_t)S->world_h;
-    size_t total_len = sizeof(MsgObstaclesHdr) + count * sizeof(uint8_t);
-    uint8_t *buf = (uint8_t*)malloc(total_len);
-    if (!buf) return;
+    size_t total_len = sizeof(MsgObstaclesHdr) + (count + 7u) / 8u;
+    Frame *f = frame_alloc(MSG_OBSTACLES_BITS, sizeof(MsgHdr) + total_len);
+    if (!f) return;
+    MsgHdr h = { MSG_OBSTACLES_BITS, (uint32_t)total_len };
     MsgObstaclesHdr hdr = { .world_w = (uint32_t)S->world_w, .world_h = (uint32_t)S->world_h };
-    memcpy(buf, &hdr, sizeof(hdr));
-    memcpy(buf + sizeof(hdr), S->obstacles, count * sizeof(uint8_t));
-    MsgHdr h = { MSG_OBSTACLES, (uint32_t)total_len };
-    (void)send_all(fd, &h, sizeof(h));
-    (void)send_all(fd, buf, (size_t)total_len);
-    free(buf);
+    memcpy(f->data, &h, sizeof(h));
+    memcpy(f->data + sizeof(h), &hdr, sizeof(hdr));
+    obstacles_pack(S->obstacles, count, f->data + sizeof(h) + sizeof(hdr));
+    greet_push(S, c, f);
 }
 
-void clients_broadcast(Server *S, uint32_t type, const void *payload, uint32_t len) {
-    MsgHdr h = { type, len };
+static void greet_streams(Server *S, Client *c, uint32_t subs) {
+    if (subs & SUB_PROGRESS) send_progress(S, c);
+    if (subs & SUB_STEPS) send_history(S, c);
+    if (subs & SUB_OBSTACLES) send_obstacles(S, c);
+}
+
+static void greet(Server *S, Client *c) {
+    send_welcome(S, c);
+    greet_streams(S, c, c->subs);
+}
+
+void clients_greet_all(Server *S) {
+    for (Client *c = S->clients; c; c = c->next) {
+        greet(S, c);
+    }
+}
+
+static int stream_of(uint32_t type) {
+    switch (type) {
+    case MSG_STEP:
+    case MSG_STEPS: return STREAM_STEPS;
+    case MSG_PROGRESS: return STREAM_PROGRESS;
+    case MSG_STATS: return STREAM_STATS;
+    case MSG_OBSTACLES:
+    case MSG_OBSTACLES_BITS: return STREAM_OBSTACLES;
+    default: return -1;
+    }
+}
+
+static int64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000ll + t.tv_nsec;
+}
 
+// One frame per broadcast, shared by every client queue that wants it and
+// only built once one does. The net loop writes it out, and drops clients
+// whose queue has closed. A final update skips the clients' rate limits.
+static void broadcast(Server *S, uint32_t type, const void *payload, uint32_t len, int final) {
+    int stream = stream_of(type);
+    if (stream >= 0 && !server_wants(S, stream)) return;
     pthread_mutex_lock(&S->clients_mtx);
-    Client **pp = &S->clients;
-    while (*pp) {
-        Client *c = *pp;
-        if (send_all(c->fd, &h, sizeof(h)) != 0 || (len && send_all(c->fd, payload, len) != 0)) {
-            close(c->fd);
-            *pp = c->next;
-            free(c);
-            atomic_fetch_sub(&S->active_clients, 1);
-            continue;
+    if (S->emit) S->emit(S->emit_ctx, type, payload, len);
+    Frame *f = NULL;
+    int64_t now = 0;
+    for (Client *c = S->clients; c; c = c->next) {
+        if (stream >= 0) {
+            if (!(c->subs & (1u << stream))) continue;
+            if (c->gap_ns[stream] > 0) {
+                if (!now) now = now_ns();
+                if (!final && now < c->due_ns[stream]) continue;
+                c->due_ns[stream] = now + c->gap_ns[stream];
+            }
         }
-        pp = &(*pp)->next;
+        if (!f && !(f = frame_new(type, payload, len))) break;
+        outq_push(&c->q, &S->outq, f, 0);
+        net_loop_kick(S->loop, c);
     }
+    frame_unref(f);
     pthread_mutex_unlock(&S->clients_mtx);
 }
 
-static void *client_reader_thread(void *arg) {
-    struct { Server *S; int fd; } *ctx = arg;
-    Server *S = ctx->S;
-    int fd = ctx->fd;
-    free(ctx);
+void clients_broadcast(Server *S, uint32_t type, const void *payload, uint32_t len) {
+    broadcast(S, type, payload, len, 0);
+}
 
-    for (;;) {
-        MsgHdr h;
-        int rr = recv_all(fd, &h, sizeof(h));
-        if (rr <= 0) break;
+// For the last update of a run, which rate-limited clients must not miss.
+void clients_broadcast_final(Server *S, uint32_t type, const void *payload, uint32_t len) {
+    broadcast(S, type, payload, len, 1);
+}
 
-        if (h.len > 1024) {
-            break;
-        }
+// Moves c's streams in or out of the subscriber counts. Caller holds
+// clients_mtx.
+static void subs_count(Server *S, uint32_t subs, int delta) {
+    for (int i = 0; i < STREAM_COUNT; i++) {
+        if (subs & (1u << i)) atomic_fetch_add(&S->subscribers[i], delta);
+    }
+}
 
-        uint8_t payload[1024];
-        if (h.len) {
-            rr = recv_all(fd, payload, h.len);
-            if (rr <= 0) break;
-        }
+static int64_t hz_gap_ns(uint32_t hz) {
+    return hz ? 1000000000ll / hz : 0;
+}
 
-        if (h.type == MSG_STOP && h.len == 0) {
-            fprintf(stderr, "Server: STOP received\n");
-            atomic_store(&S->running, 0);
-            break;
-        }
+void publish_config_env(int hz[STREAM_COUNT]) {
+    const char *progress = getenv("RW_PROGRESS_HZ");
+    const char *stats = getenv("RW_STATS_HZ");
+    for (int i = 0; i < STREAM_COUNT; i++) hz[i] = 0;
+    hz[STREAM_PROGRESS] = (progress && *progress) ? atoi(progress) : PUBLISH_DEFAULT_PROGRESS_HZ;
+    hz[STREAM_STATS] = (stats && *stats) ? atoi(stats) : PUBLISH_DEFAULT_STATS_HZ;
+}
 
-        if (h.type == MSG_MODE && h.len == sizeof(MsgMode)) {
-            MsgMode *m = (MsgMode*)payload;
-            if (m->mode == MODE_INTERACTIVE || m->mode == MODE_SUMMARY) {
-                atomic_store(&S->mode, m->mode);
-                clients_broadcast(S, MSG_MODE, m, sizeof(*m));
-            }
-        }
+// Whether an update for stream may be built and sent now; a yes claims
+// the slot until the next gap is over, so of two threads asking at once
+// only one sends. Final updates bypass this. The coarse clock keeps the
+// check cheap enough to make on every replication.
+int server_publish_due(Server *S, int stream) {
+    if (!server_wants(S, stream)) return 0;
+    if (S->publish_hz[stream] <= 0) return 1;
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &t);
+    long long now = (long long)t.tv_sec * 1000000000ll + t.tv_nsec;
+    long long due = atomic_load_explicit(&S->publish_due_ns[stream], memory_order_relaxed);
+    if (now < due) return 0;
+    return atomic_compare_exchange_strong(&S->publish_due_ns[stream], &due,
+                                          now + hz_gap_ns((uint32_t)S->publish_hz[stream]));
+}
+
+static void send_progress_now(Server *S, uint32_t current, uint32_t total, int final) {
+    MsgProgress p = { .current_replication = current, .total_replications = total };
+    broadcast(S, MSG_PROGRESS, &p, sizeof(p), final);
+}
+
+// Progress that comes too soon only replaces the parked value, which
+// server_progress_flush sends once the gap is over.
+void server_progress(Server *S, uint32_t current, uint32_t total) {
+    if (!server_wants(S, STREAM_PROGRESS)) return;
+    if (server_publish_due(S, STREAM_PROGRESS)) {
+        atomic_store_explicit(&S->pending_progress, 0, memory_order_relaxed);
+        send_progress_now(S, current, total, 0);
+        return;
     }
+    atomic_store_explicit(&S->pending_progress, ((uint64_t)current << 32) | total,
+                          memory_order_relaxed);
+}
 
+// Called with showcase_mtx held, on every tick of the showcase thread.
+void server_progress_flush(Server *S) {
+    if (!atomic_load_explicit(&S->pending_progress, memory_order_relaxed)) return;
+    if (!server_publish_due(S, STREAM_PROGRESS)) return;
+    uint64_t v = atomic_exchange(&S->pending_progress, 0);
+    if (v) send_progress_now(S, (uint32_t)(v >> 32), (uint32_t)v, 0);
+}
+
+// Skips the rate limits. Parked progress is dropped under showcase_mtx,
+// so a flush cannot send an older count after this one.
+void server_progress_final(Server *S, uint32_t current, uint32_t total) {
+    pthread_mutex_lock(&S->showcase_mtx);
+    atomic_store(&S->pending_progress, 0);
+    send_progress_now(S, current, total, 1);
+    pthread_mutex_unlock(&S->showcase_mtx);
+}
+
+static void client_subscribe(Server *S, Client *c, const MsgSubscribe *m) {
+    uint32_t subs = m->streams & SUB_ALL;
+    pthread_mutex_lock(&S->showcase_mtx);
     pthread_mutex_lock(&S->clients_mtx);
-    Client **pp = &S->clients;
-    while (*pp) {
-        if ((*pp)->fd == fd) {
-            Client *victim = *pp;
-            *pp = victim->next;
-            close(victim->fd);
-            free(victim);
-            atomic_fetch_sub(&S->active_clients, 1);
+    uint32_t added = subs & ~c->subs;
+    subs_count(S, c->subs & ~subs, -1);
+    subs_count(S, added, 1);
+    c->subs = subs;
+    c->gap_ns[STREAM_PROGRESS] = hz_gap_ns(m->progress_hz);
+    c->gap_ns[STREAM_STATS] = hz_gap_ns(m->stats_hz);
+    // A stream taken up mid-run starts from the current state.
+    if (S->jobs > 0 && !S->restarting && added) greet_streams(S, c, added);
+    pthread_mutex_unlock(&S->clients_mtx);
+    pthread_mutex_unlock(&S->showcase_mtx);
+}
+
+// Sessions under a host may not have run a job yet, and a restarting one
+// is half built; their clients are greeted by job_restart once it is done. The walker sends and records
+// steps under showcase_mtx, so holding it keeps the history a client gets
+// and the runs that follow from overlapping.
+void client_attach(Server *S, Client *c) {
+    c->S = S;
+    c->subs = SUB_ALL;
+    pthread_mutex_lock(&S->showcase_mtx);
+    pthread_mutex_lock(&S->clients_mtx);
+    subs_count(S, c->subs, 1);
+    if (S->jobs > 0 && !S->restarting) greet(S, c);
+    c->next = S->clients;
+    S->clients = c;
+    pthread_mutex_unlock(&S->clients_mtx);
+    pthread_mutex_unlock(&S->showcase_mtx);
+    atomic_fetch_add(&S->active_clients, 1);
+}
+
+void client_detach(Server *S, Client *c) {
+    pthread_mutex_lock(&S->clients_mtx);
+    for (Client **pp = &S->clients; *pp; pp = &(*pp)->next) {
+        if (*pp == c) {
+            *pp = c->next;
             break;
         }
-        pp = &(*pp)->next;
     }
+    subs_count(S, c->subs, -1);
     pthread_mutex_unlock(&S->clients_mtx);
-    return NULL;
+    atomic_fetch_sub(&S->active_clients, 1);
 }
 
-void *accept_thread(void *arg) {
-    Server *S = (Server*)arg;
-    while (atomic_load(&S->running)) {
-        int cfd = accept(S->listen_fd, NULL, NULL);
-        if (cfd < 0) {
-            if (errno == EINTR) continue;
-            if (!atomic_load(&S->running)) break;
-            perror("accept");
-            break;
-        }
+// Runs on the net loop thread. Returns 0 to close the connection.
+int client_message(Server *S, Client *c, uint32_t type, const uint8_t *payload, uint32_t len) {
+    if (type == MSG_STOP && len == 0) {
+        fprintf(stderr, "Server: STOP received\n");
+        if (!S->host) atomic_store(&S->alive, 0);
+        atomic_store(&S->running, 0);
+        job_wake(S);
+        return 0;
+    }
 
-        Client *c = (Client*)calloc(1, sizeof(Client));
-        c->fd = cfd;
+    if (type == MSG_JOB && len == sizeof(MsgJob)) {
+        MsgJob job;
+        memcpy(&job, payload, sizeof(job));
+        job.obstacle_file[sizeof(job.obstacle_file) - 1] = '\0';
+        job.results_path[sizeof(job.results_path) - 1] = '\0';
+        job.base_file[sizeof(job.base_file) - 1] = '\0';
+        if (job_validate(&job)) {
+            job_submit(S, &job);
+        } else {
+            static const char msg[] = "Job rejected: invalid settings.";
+            greet_push(S, c, frame_new(MSG_ERROR, msg, (uint32_t)(sizeof(msg) - 1)));
+        }
+    }
 
-        int no_clients = (atomic_load(&S->active_clients) == 0);
-        int sim_started = atomic_load(&S->sim_started);
-        if (no_clients && sim_started) {
-            atomic_store(&S->mode, MODE_SUMMARY);
+    if (type == MSG_MODE && len == sizeof(MsgMode)) {
+        MsgMode m;
+        memcpy(&m, payload, sizeof(m));
+        if (m.mode == MODE_INTERACTIVE || m.mode == MODE_SUMMARY) {
+            atomic_store(&S->mode, m.mode);
+            clients_broadcast(S, MSG_MODE, &m, sizeof(m));
         }
+    }
 
-        send_welcome(S, cfd);
-        send_progress(S, cfd);
-        send_history(S, cfd);
-        send_obstacles(S, cfd);
+    if (type == MSG_SUBSCRIBE && len == sizeof(MsgSubscribe)) {
+        MsgSubscribe m;
+        memcpy(&m, payload, sizeof(m));
+        client_subscribe(S, c, &m);
+    }
+    return 1;
+}
 
-        pthread_mutex_lock(&S->clients_mtx);
-        c->next = S->clients;
-        S->clients = c;
-        pthread_mutex_unlock(&S->clients_mtx);
-        atomic_fetch_add(&S->active_clients, 1);
+// Single-run servers attach every connection straight away; the first one
+// starts a run that was waiting for a client.
+void server_accept(Server *S, Client *c) {
+    int no_clients = (atomic_load(&S->active_clients) == 0);
+    int sim_started = atomic_load(&S->sim_started);
+    if (no_clients && sim_started) {
+        atomic_store(&S->mode, MODE_SUMMARY);
+    }
 
-        int expected = 0;
-        if (atomic_compare_exchange_strong(&S->sim_started, &expected, 1)) {
-            pthread_create(&S->sim_th, NULL, sim_thread, S);
-        }
+    client_attach(S, c);
 
-        pthread_t th;
-        struct { Server *S; int fd; } *ctx = malloc(sizeof(*ctx));
-        ctx->S = S; ctx->fd = cfd;
-        pthread_create(&th, NULL, client_reader_thread, ctx);
-        pthread_detach(th);
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&S->sim_started, &expected, 1)) {
+        pthread_create(&S->sim_th, NULL, sim_thread, S);
     }
-    return NULL;
 }
 
-int make_listen_socket(Server *S) {
-    S->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (S->listen_fd < 0) return -1;
+int listen_unix(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
 
     struct sockaddr_un addr;
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, S->sock_path, sizeof(addr.sun_path) - 1);
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
 
-    unlink(S->sock_path);
-    if (bind(S->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) return -1;
-    if (listen(S->listen_fd, 32) < 0) return -1;
-    return 0;
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 32) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int make_listen_socket(Server *S) {
+    S->listen_fd = listen_unix(S->sock_path);
+    return (S->listen_fd < 0) ? -1 : 0;
 }
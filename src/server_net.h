@@ -2,6 +2,26 @@
 
 #include "server_types.h"
 
+#define PUBLISH_DEFAULT_PROGRESS_HZ 30
+#define PUBLISH_DEFAULT_STATS_HZ 10
+
+void server_welcome(Server *S, MsgWelcome *out);
+void clients_greet_all(Server *S);
 void clients_broadcast(Server *S, uint32_t type, const void *payload, uint32_t len);
+void clients_broadcast_final(Server *S, uint32_t type, const void *payload, uint32_t len);
+void client_attach(Server *S, Client *c);
+void client_detach(Server *S, Client *c);
+int client_message(Server *S, Client *c, uint32_t type, const uint8_t *payload, uint32_t len);
+void server_accept(Server *S, Client *c);
+int listen_unix(const char *path);
 int make_listen_socket(Server *S);
-void *accept_thread(void *arg);
+void publish_config_env(int hz[STREAM_COUNT]);
+int server_publish_due(Server *S, int stream);
+void server_progress(Server *S, uint32_t current, uint32_t total);
+void server_progress_final(Server *S, uint32_t current, uint32_t total);
+void server_progress_flush(Server *S);
+
+// Lets producers skip building frames for a stream nobody subscribes to.
+static inline int server_wants(Server *S, int stream) {
+    return S->emit || atomic_load_explicit(&S->subscribers[stream], memory_order_relaxed) > 0;
+}
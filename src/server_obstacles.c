@@ -0,0 +1,728 @@
+#include "server_obstacles.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rng.h"
+
+typedef struct {
+    int w, h, nw;
+    int nbands;
+    const uint8_t *obs;
+    uint64_t *free_bits;
+    uint64_t *reach;
+    uint64_t *edges;
+    uint64_t *halos;
+    pthread_mutex_t start_mtx;
+    pthread_barrier_t barrier;
+    atomic_int changed[3];
+    atomic_int complete;
+} ReachShared;
+
+typedef struct {
+    ReachShared *sh;
+    int band;
+    int y0, y1;
+} ReachJob;
+
+size_t reachability_row_words(int w) {
+    return ((size_t)w + 63u) / 64u;
+}
+
+static uint64_t fill_right(uint64_t g, uint64_t p) {
+    g |= p & (g << 1);  p &= p << 1;
+    g |= p & (g << 2);  p &= p << 2;
+    g |= p & (g << 4);  p &= p << 4;
+    g |= p & (g << 8);  p &= p << 8;
+    g |= p & (g << 16); p &= p << 16;
+    g |= p & (g << 32);
+    return g;
+}
+
+static uint64_t fill_left(uint64_t g, uint64_t p) {
+    g |= p & (g >> 1);  p &= p >> 1;
+    g |= p & (g >> 2);  p &= p >> 2;
+    g |= p & (g >> 4);  p &= p >> 4;
+    g |= p & (g >> 8);  p &= p >> 8;
+    g |= p & (g >> 16); p &= p >> 16;
+    g |= p & (g >> 32);
+    return g;
+}
+
+// Closes a row horizontally: Kogge-Stone fill inside each word, carries
+// across word boundaries and wraps between x = w-1 and x = 0.
+static void row_fill(uint64_t *r, const uint64_t *f, int nw, int w) {
+    int last = (w - 1) & 63;
+    for (;;) {
+        int changed = 0;
+        uint64_t carry = (r[nw - 1] >> last) & 1u;
+        for (int k = 0; k < nw; k++) {
+            uint64_t g = fill_right(r[k] | (carry & f[k]), f[k]);
+            if (g != r[k]) { r[k] = g; changed = 1; }
+            carry = g >> 63;
+        }
+        carry = r[0] & 1u;
+        for (int k = nw - 1; k >= 0; k--) {
+            uint64_t in = (k == nw - 1) ? carry << last : carry << 63;
+            uint64_t g = fill_left(r[k] | (in & f[k]), f[k]);
+            if (g != r[k]) { r[k] = g; changed = 1; }
+            carry = g & 1u;
+        }
+        if (!changed) break;
+    }
+}
+
+static int row_update(uint64_t *r, const uint64_t *f, const uint64_t *above,
+                      const uint64_t *below, int nw, int w) {
+    int grew = 0;
+    for (int k = 0; k < nw; k++) {
+        uint64_t g = r[k] | ((above[k] | below[k]) & f[k]);
+        if (g != r[k]) { r[k] = g; grew = 1; }
+    }
+    if (grew) row_fill(r, f, nw, w);
+    return grew;
+}
+
+static int band_sweep(ReachShared *sh, int y0, int y1, const uint64_t *top, const uint64_t *bottom) {
+    size_t nw = (size_t)sh->nw;
+    int changed = 0;
+    for (int y = y0; y < y1; y++) {
+        const uint64_t *above = (y == y0) ? top : sh->reach + (size_t)(y - 1) * nw;
+        const uint64_t *below = (y == y1 - 1) ? bottom : sh->reach + (size_t)(y + 1) * nw;
+        changed |= row_update(sh->reach + (size_t)y * nw, sh->free_bits + (size_t)y * nw,
+                              above, below, sh->nw, sh->w);
+    }
+    for (int y = y1 - 1; y >= y0; y--) {
+        const uint64_t *above = (y == y0) ? top : sh->reach + (size_t)(y - 1) * nw;
+        const uint64_t *below = (y == y1 - 1) ? bottom : sh->reach + (size_t)(y + 1) * nw;
+        changed |= row_update(sh->reach + (size_t)y * nw, sh->free_bits + (size_t)y * nw,
+                              above, below, sh->nw, sh->w);
+    }
+    return changed;
+}
+
+// Each band floods its own rows to a local fixpoint, then trades its first
+// and last rows with the neighbouring bands (wrapping top to bottom) until
+// no band grows during a round.
+static void *reach_band(void *arg) {
+    ReachJob *j = (ReachJob*)arg;
+    ReachShared *sh = j->sh;
+    pthread_mutex_lock(&sh->start_mtx);
+    pthread_mutex_unlock(&sh->start_mtx);
+
+    size_t nw = (size_t)sh->nw;
+    int w = sh->w;
+    int cx = w / 2;
+    int cy = sh->h / 2;
+    for (int y = j->y0; y < j->y1; y++) {
+        uint64_t *f = sh->free_bits + (size_t)y * nw;
+        uint64_t *r = sh->reach + (size_t)y * nw;
+        const uint8_t *o = sh->obs + (size_t)y * (size_t)w;
+        memset(f, 0, nw * sizeof(uint64_t));
+        memset(r, 0, nw * sizeof(uint64_t));
+        for (int x = 0; x < w; x++) {
+            if (!o[x]) f[x >> 6] |= 1ull << (x & 63);
+        }
+        if (y == cy && !o[cx]) {
+            r[cx >> 6] |= 1ull << (cx & 63);
+            row_fill(r, f, sh->nw, w);
+        }
+    }
+
+    uint64_t *my_edges = sh->edges + (size_t)j->band * 2u * nw;
+    uint64_t *top = sh->halos + (size_t)j->band * 2u * nw;
+    uint64_t *bottom = top + nw;
+    int prev = (j->band + sh->nbands - 1) % sh->nbands;
+    int next = (j->band + 1) % sh->nbands;
+    memcpy(my_edges, sh->reach + (size_t)j->y0 * nw, nw * sizeof(uint64_t));
+    memcpy(my_edges + nw, sh->reach + (size_t)(j->y1 - 1) * nw, nw * sizeof(uint64_t));
+    pthread_barrier_wait(&sh->barrier);
+
+    for (unsigned iter = 0;; iter++) {
+        memcpy(top, sh->edges + ((size_t)prev * 2u + 1u) * nw, nw * sizeof(uint64_t));
+        memcpy(bottom, sh->edges + (size_t)next * 2u * nw, nw * sizeof(uint64_t));
+        if (j->band == 0) atomic_store(&sh->changed[(iter + 1) % 3], 0);
+        pthread_barrier_wait(&sh->barrier);
+
+        int changed = 0;
+        while (band_sweep(sh, j->y0, j->y1, top, bottom)) changed = 1;
+        memcpy(my_edges, sh->reach + (size_t)j->y0 * nw, nw * sizeof(uint64_t));
+        memcpy(my_edges + nw, sh->reach + (size_t)(j->y1 - 1) * nw, nw * sizeof(uint64_t));
+        if (changed) atomic_store(&sh->changed[iter % 3], 1);
+        pthread_barrier_wait(&sh->barrier);
+        if (!atomic_load(&sh->changed[iter % 3])) break;
+    }
+
+    size_t begin = (size_t)j->y0 * nw;
+    size_t end = (size_t)j->y1 * nw;
+    for (size_t k = begin; k < end; k++) {
+        if (sh->reach[k] != sh->free_bits[k]) {
+            atomic_store(&sh->complete, 0);
+            break;
+        }
+    }
+    return NULL;
+}
+
+int reachability_map(int w, int h, const uint8_t *obs, uint64_t *out_bits) {
+    if (w <= 0 || h <= 0 || !obs) return -1;
+    size_t nw = reachability_row_words(w);
+    size_t words = nw * (size_t)h;
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = (ncpu > 0) ? (int)ncpu : 1;
+    if (nthreads > OBSTACLE_MAX_THREADS) nthreads = OBSTACLE_MAX_THREADS;
+    if (nthreads > h / OBSTACLE_MIN_BAND_ROWS) nthreads = h / OBSTACLE_MIN_BAND_ROWS;
+    if (nthreads < 1) nthreads = 1;
+
+    ReachShared sh;
+    memset(&sh, 0, sizeof(sh));
+    sh.w = w;
+    sh.h = h;
+    sh.nw = (int)nw;
+    sh.obs = obs;
+    sh.free_bits = (uint64_t*)malloc(words * sizeof(uint64_t));
+    sh.reach = out_bits ? out_bits : (uint64_t*)malloc(words * sizeof(uint64_t));
+    sh.edges = (uint64_t*)malloc((size_t)nthreads * 2u * nw * sizeof(uint64_t));
+    sh.halos = (uint64_t*)malloc((size_t)nthreads * 2u * nw * sizeof(uint64_t));
+    if (!sh.free_bits || !sh.reach || !sh.edges || !sh.halos) {
+        free(sh.free_bits);
+        if (!out_bits) free(sh.reach);
+        free(sh.edges);
+        free(sh.halos);
+        return -1;
+    }
+    atomic_init(&sh.complete, 1);
+    for (int i = 0; i < 3; i++) atomic_init(&sh.changed[i], 0);
+    pthread_mutex_init(&sh.start_mtx, NULL);
+
+    ReachJob jobs[OBSTACLE_MAX_THREADS];
+    pthread_t th[OBSTACLE_MAX_THREADS];
+    int started = 1;
+    pthread_mutex_lock(&sh.start_mtx);
+    for (int t = 1; t < nthreads; t++) {
+        jobs[t].sh = &sh;
+        if (pthread_create(&th[t], NULL, reach_band, &jobs[t]) != 0) break;
+        started++;
+    }
+    sh.nbands = started;
+    for (int t = 0; t < started; t++) {
+        jobs[t].sh = &sh;
+        jobs[t].band = t;
+        jobs[t].y0 = (int)((long long)h * t / started);
+        jobs[t].y1 = (int)((long long)h * (t + 1) / started);
+    }
+    pthread_barrier_init(&sh.barrier, NULL, (unsigned)started);
+    pthread_mutex_unlock(&sh.start_mtx);
+    reach_band(&jobs[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(th[t], NULL);
+    }
+    pthread_barrier_destroy(&sh.barrier);
+    pthread_mutex_destroy(&sh.start_mtx);
+
+    int complete = atomic_load(&sh.complete);
+    free(sh.free_bits);
+    if (!out_bits) free(sh.reach);
+    free(sh.edges);
+    free(sh.halos);
+    return complete;
+}
+
+int check_reachability(int w, int h, const uint8_t *obs) {
+    if (!obs) return 1;
+    if (obs[(size_t)(h / 2) * (size_t)w + (size_t)(w / 2)]) return 0;
+    return reachability_map(w, h, obs, NULL) == 1;
+}
+
+static int load_obstacles_file(const char *path, int w, int h, uint8_t **out_obs) {
+    if (!path || !out_obs || w <= 0 || h <= 0) return 0;
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+
+    size_t count = (size_t)w * (size_t)h;
+    uint8_t *obs = (uint8_t*)calloc(count, sizeof(uint8_t));
+    if (!obs) {
+        fclose(fp);
+        return 0;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        int x = 0, y = 0;
+        int scanned = sscanf(line, " %d , %d ", &x, &y);
+        if (scanned != 2) {
+            size_t len = strcspn(line, "\r\n");
+            if (len == 0) continue;
+            fclose(fp);
+            free(obs);
+            return 0;
+        }
+        if (x < 0 || x >= w || y < 0 || y >= h) {
+            fclose(fp);
+            free(obs);
+            return 0;
+        }
+        obs[(size_t)y * (size_t)w + (size_t)x] = 1;
+    }
+
+    fclose(fp);
+    *out_obs = obs;
+    return 1;
+}
+
+static const char *pbm_skip(const char *p, const char *end) {
+    while (p < end) {
+        if (*p == '#') {
+            while (p < end && *p != '\n') p++;
+        } else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+            p++;
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+static const char *pbm_int(const char *p, const char *end, int *out) {
+    long v = 0;
+    const char *start = p;
+    while (p < end && *p >= '0' && *p <= '9' && v <= 1000000) {
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    if (p == start || v <= 0 || v > 1000000) return NULL;
+    *out = (int)v;
+    return p;
+}
+
+int obstacles_is_pbm(const char *path) {
+    if (!path) return 0;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    char magic[2] = {0};
+    size_t n = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return n == 2 && magic[0] == 'P' && magic[1] == '4';
+}
+
+// PBM P4: "P4 <w> <h>" then MSB-first rows padded to whole bytes, 1 = obstacle.
+static int load_obstacles_pbm(const char *path, int *out_w, int *out_h, uint8_t **out_obs) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 8) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    const char *map = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+    madvise((void*)map, size, MADV_SEQUENTIAL);
+
+    const char *end = map + size;
+    const char *p = map + 2;
+    int w = 0, h = 0;
+    int ok = map[0] == 'P' && map[1] == '4';
+    if (ok) ok = (p = pbm_int(pbm_skip(p, end), end, &w)) != NULL;
+    if (ok) ok = (p = pbm_int(pbm_skip(p, end), end, &h)) != NULL;
+    if (ok) ok = p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n');
+
+    size_t row_bytes = ((size_t)w + 7u) / 8u;
+    uint8_t *obs = NULL;
+    if (ok) {
+        p++;
+        ok = (size_t)(end - p) >= row_bytes * (size_t)h;
+    }
+    if (ok) {
+        obs = (uint8_t*)malloc((size_t)w * (size_t)h);
+        ok = obs != NULL;
+    }
+    if (ok) {
+        const uint8_t *bits = (const uint8_t*)p;
+        for (int y = 0; y < h; y++) {
+            const uint8_t *row = bits + (size_t)y * row_bytes;
+            uint8_t *dst = obs + (size_t)y * (size_t)w;
+            for (int x = 0; x < w; x++) {
+                dst[x] = (row[x >> 3] >> (7 - (x & 7))) & 1u;
+            }
+        }
+    }
+    munmap((void*)map, size);
+    if (!ok) {
+        free(obs);
+        return 0;
+    }
+    *out_w = w;
+    *out_h = h;
+    *out_obs = obs;
+    return 1;
+}
+
+size_t obstacles_pack(const uint8_t *obs, size_t count, uint8_t *out_bits) {
+    size_t bytes = (count + 7u) / 8u;
+    memset(out_bits, 0, bytes);
+    for (size_t i = 0; i < count; i++) {
+        if (obs[i]) out_bits[i >> 3] |= (uint8_t)(1u << (i & 7));
+    }
+    return bytes;
+}
+
+typedef struct {
+    uint8_t *obs;
+    int w, h;
+    int y0, y1;
+    float density;
+    uint64_t seed;
+} FillJob;
+
+static void *fill_rows(void *arg) {
+    FillJob *j = (FillJob*)arg;
+    int cx = j->w / 2;
+    int cy = j->h / 2;
+    for (int y = j->y0; y < j->y1; y++) {
+        Rng r;
+        rng_seed(&r, j->seed, 1u + (uint64_t)y);
+        uint8_t *row = j->obs + (size_t)y * (size_t)j->w;
+        for (int x = 0; x < j->w; x++) {
+            row[x] = rng_float(&r) < j->density;
+        }
+        if (y == 0) row[0] = 0;
+        if (y == cy) row[cx] = 0;
+    }
+    return NULL;
+}
+
+static void fill_parallel(uint8_t *obs, int w, int h, float density, uint64_t seed) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = (ncpu > 0) ? (int)ncpu : 1;
+    if (nthreads > OBSTACLE_MAX_THREADS) nthreads = OBSTACLE_MAX_THREADS;
+    if (nthreads > h) nthreads = h;
+
+    FillJob jobs[OBSTACLE_MAX_THREADS];
+    pthread_t th[OBSTACLE_MAX_THREADS];
+    int started[OBSTACLE_MAX_THREADS] = {0};
+    for (int t = 0; t < nthreads; t++) {
+        jobs[t] = (FillJob){
+            .obs = obs, .w = w, .h = h, .density = density, .seed = seed,
+            .y0 = (int)((long long)h * t / nthreads),
+            .y1 = (int)((long long)h * (t + 1) / nthreads)
+        };
+    }
+    for (int t = 1; t < nthreads; t++) {
+        started[t] = (pthread_create(&th[t], NULL, fill_rows, &jobs[t]) == 0);
+        if (!started[t]) fill_rows(&jobs[t]);
+    }
+    fill_rows(&jobs[0]);
+    for (int t = 1; t < nthreads; t++) {
+        if (started[t]) pthread_join(th[t], NULL);
+    }
+}
+
+static int bit_get(const uint64_t *bits, size_t nw, int x, int y) {
+    return (int)((bits[(size_t)y * nw + (size_t)(x >> 6)] >> (x & 63)) & 1u);
+}
+
+static void bit_set(uint64_t *bits, size_t nw, int x, int y) {
+    bits[(size_t)y * nw + (size_t)(x >> 6)] |= 1ull << (x & 63);
+}
+
+static int wrap(int v, int n) {
+    v %= n;
+    return (v < 0) ? v + n : v;
+}
+
+// 0-1 BFS over the window around (x0, y0) where stepping onto an obstacle
+// costs 1. Clears the obstacles on the cheapest path to a reached cell and
+// returns 1, or returns 0 when no reached cell lies inside the window.
+static int repair_local(uint8_t *obs, int w, int h, const uint64_t *reach, size_t nw, int x0, int y0) {
+    enum { SIDE = 2 * OBSTACLE_REPAIR_RADIUS + 1, CELLS = SIDE * SIDE };
+    uint16_t dist[CELLS];
+    uint16_t from[CELLS];
+    // A cell is pushed at most twice, once at d+1 and once at d.
+    uint16_t deque[2 * CELLS];
+    size_t cap = 2 * CELLS;
+    size_t head = 0, len = 0;
+    for (int i = 0; i < CELLS; i++) dist[i] = UINT16_MAX;
+
+    int start = OBSTACLE_REPAIR_RADIUS * SIDE + OBSTACLE_REPAIR_RADIUS;
+    dist[start] = 0;
+    deque[len++] = (uint16_t)start;
+    int found = -1;
+    while (len) {
+        int i = deque[head];
+        head = (head + 1) % cap;
+        len--;
+        int x = wrap(x0 + i % SIDE - OBSTACLE_REPAIR_RADIUS, w);
+        int y = wrap(y0 + i / SIDE - OBSTACLE_REPAIR_RADIUS, h);
+        if (bit_get(reach, nw, x, y)) {
+            found = i;
+            break;
+        }
+        static const int dx[4] = { 1, -1, 0, 0 };
+        static const int dy[4] = { 0, 0, 1, -1 };
+        for (int k = 0; k < 4; k++) {
+            int lx = i % SIDE + dx[k];
+            int ly = i / SIDE + dy[k];
+            if (lx < 0 || lx >= SIDE || ly < 0 || ly >= SIDE) continue;
+            int n = ly * SIDE + lx;
+            int cost = obs[(size_t)wrap(y + dy[k], h) * (size_t)w + (size_t)wrap(x + dx[k], w)];
+            if (dist[i] + cost >= dist[n]) continue;
+            dist[n] = (uint16_t)(dist[i] + cost);
+            from[n] = (uint16_t)i;
+            if (cost) {
+                deque[(head + len++) % cap] = (uint16_t)n;
+            } else {
+                head = (head + cap - 1) % cap;
+                deque[head] = (uint16_t)n;
+                len++;
+            }
+        }
+    }
+    if (found < 0) return 0;
+    for (int i = found; i != start; i = from[i]) {
+        int x = wrap(x0 + i % SIDE - OBSTACLE_REPAIR_RADIUS, w);
+        int y = wrap(y0 + i / SIDE - OBSTACLE_REPAIR_RADIUS, h);
+        obs[(size_t)y * (size_t)w + (size_t)x] = 0;
+    }
+    return 1;
+}
+
+// Marks the free cells connected to (x, y) that are not reached yet.
+static int flood_reach(const uint8_t *obs, int w, int h, uint64_t *reach, size_t nw, int x, int y) {
+    size_t cap = 1024, len = 0;
+    uint32_t *stack = (uint32_t*)malloc(cap * sizeof(uint32_t));
+    if (!stack) return 0;
+    bit_set(reach, nw, x, y);
+    stack[len++] = (uint32_t)((size_t)y * (size_t)w + (size_t)x);
+    while (len) {
+        uint32_t idx = stack[--len];
+        int cx = (int)(idx % (uint32_t)w);
+        int cy = (int)(idx / (uint32_t)w);
+        int nx[4] = { wrap(cx + 1, w), wrap(cx - 1, w), cx, cx };
+        int ny[4] = { cy, cy, wrap(cy + 1, h), wrap(cy - 1, h) };
+        for (int k = 0; k < 4; k++) {
+            size_t n = (size_t)ny[k] * (size_t)w + (size_t)nx[k];
+            if (obs[n] || bit_get(reach, nw, nx[k], ny[k])) continue;
+            if (len == cap) {
+                uint32_t *grown = (uint32_t*)realloc(stack, 2u * cap * sizeof(uint32_t));
+                if (!grown) {
+                    free(stack);
+                    return 0;
+                }
+                stack = grown;
+                cap *= 2;
+            }
+            bit_set(reach, nw, nx[k], ny[k]);
+            stack[len++] = (uint32_t)n;
+        }
+    }
+    free(stack);
+    return 1;
+}
+
+// Joins a stranded cell to the reached area: the cheapest local path if the
+// window holds one, else straight towards the center until a reached cell.
+static int repair_cell(uint8_t *obs, int w, int h, uint64_t *reach, size_t nw, int x, int y) {
+    if (!repair_local(obs, w, h, reach, nw, x, y)) {
+        int cx = w / 2, cy = h / 2;
+        int px = x, py = y;
+        while (!bit_get(reach, nw, px, py)) {
+            obs[(size_t)py * (size_t)w + (size_t)px] = 0;
+            if (abs(px - cx) >= abs(py - cy)) px += (px < cx) ? 1 : -1;
+            else py += (py < cy) ? 1 : -1;
+        }
+    }
+    return flood_reach(obs, w, h, reach, nw, x, y);
+}
+
+// Visits the cells in square rings around the center. By the time a ring is
+// reached every free cell inside it is connected, so a stranded cell is only
+// a short repair away from the reached area. Needs the reach bitset plus a
+// fixed window, instead of per-cell distance and parent arrays.
+static int repair_components(uint8_t *obs, int w, int h) {
+    size_t nw = reachability_row_words(w);
+    uint64_t *reach = (uint64_t*)malloc(nw * (size_t)h * sizeof(uint64_t));
+    if (!reach) return 0;
+    int reachable = reachability_map(w, h, obs, reach);
+    if (reachable != 0) {
+        free(reach);
+        return reachable == 1;
+    }
+
+    int cx = w / 2, cy = h / 2;
+    int rings = cx;
+    if (w - 1 - cx > rings) rings = w - 1 - cx;
+    if (cy > rings) rings = cy;
+    if (h - 1 - cy > rings) rings = h - 1 - cy;
+    int ok = 1;
+    for (int k = 1; k <= rings && ok; k++) {
+        int ylo = (cy - k < 0) ? 0 : cy - k;
+        int yhi = (cy + k > h - 1) ? h - 1 : cy + k;
+        int xlo = (cx - k < 0) ? 0 : cx - k;
+        int xhi = (cx + k > w - 1) ? w - 1 : cx + k;
+        for (int y = ylo; y <= yhi && ok; y++) {
+            int edge = (y == cy - k || y == cy + k);
+            int step = edge ? 1 : 2 * k;
+            for (int x = edge ? xlo : cx - k; x <= xhi && ok; x += step) {
+                if (x < 0) continue;
+                if (obs[(size_t)y * (size_t)w + (size_t)x] || bit_get(reach, nw, x, y)) continue;
+                ok = repair_cell(obs, w, h, reach, nw, x, y);
+            }
+        }
+    }
+    free(reach);
+    return ok;
+}
+
+// A cell can be blocked without disconnecting anything when its free
+// 4-neighbours are joined through a single run of free cells on its 8-ring.
+static int safe_to_block(const uint8_t *obs, int w, int h, int x, int y) {
+    static const int rx[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+    static const int ry[8] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+    int free_ring[8];
+    for (int k = 0; k < 8; k++) {
+        int nx = (x + rx[k] + w) % w;
+        int ny = (y + ry[k] + h) % h;
+        free_ring[k] = !obs[(size_t)ny * (size_t)w + (size_t)nx];
+    }
+
+    int runs = 0;
+    for (int k = 0; k < 8; k++) {
+        if (!free_ring[k] || free_ring[(k + 7) % 8]) continue;
+        int has_edge = 0;
+        for (int j = k; free_ring[j % 8] && j < k + 8; j++) {
+            if ((j % 8) % 2 == 0) has_edge = 1;
+        }
+        if (has_edge) runs++;
+    }
+    return runs <= 1;
+}
+
+static int try_block(uint8_t *obs, int w, int h, int cx, int cy, size_t idx) {
+    if (obs[idx]) return 0;
+    int x = (int)(idx % (size_t)w);
+    int y = (int)(idx / (size_t)w);
+    if ((x == 0 && y == 0) || (x == cx && y == cy)) return 0;
+    if (!safe_to_block(obs, w, h, x, y)) return 0;
+    obs[idx] = 1;
+    return 1;
+}
+
+// Bijection on [0, 2^bits): keyed multiply-xorshift rounds, each invertible
+// modulo 2^bits.
+static uint64_t scramble(uint64_t v, int bits, const uint64_t key[3]) {
+    uint64_t mask = (bits >= 64) ? ~0ull : (1ull << bits) - 1u;
+    int shift = bits / 2 + 1;
+    for (int k = 0; k < 3; k++) {
+        v = (v ^ key[k]) & mask;
+        v = (v * 0x9E3779B97F4A7C15ull) & mask;
+        v ^= v >> shift;
+    }
+    return v;
+}
+
+// Returns the number of blocked cells, which stays short of the target when
+// no free cell can be blocked without cutting another off.
+static size_t top_up_density(uint8_t *obs, int w, int h, float density, uint64_t seed) {
+    size_t count = (size_t)w * (size_t)h;
+    size_t target = (size_t)((double)density * (double)count);
+    size_t blocked = 0;
+    for (size_t i = 0; i < count; i++) blocked += obs[i];
+
+    int cx = w / 2;
+    int cy = h / 2;
+    Rng r;
+    rng_seed(&r, seed, 1u + (uint64_t)h);
+    int bits = 1;
+    while (bits < 63 && (1ull << bits) < count) bits++;
+    // Each pass tries every cell once in a fresh random order, so a dense
+    // map is topped up without the picks stalling on cells already tried.
+    for (size_t added = 1; blocked < target && added; ) {
+        added = 0;
+        uint64_t key[3] = { rng_next(&r), rng_next(&r), rng_next(&r) };
+        for (uint64_t i = 0; blocked < target && i < (1ull << bits); i++) {
+            uint64_t idx = scramble(i, bits, key);
+            if (idx < count && try_block(obs, w, h, cx, cy, (size_t)idx)) {
+                blocked++;
+                added++;
+            }
+        }
+    }
+    return blocked;
+}
+
+static int generate_random_obstacles(Server *S) {
+    if (!S->obstacle_mode) return 1;
+    if (S->world_w < 3 || S->world_h < 3) return 0;
+
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+    S->obstacles = (uint8_t*)calloc(count, sizeof(uint8_t));
+    if (!S->obstacles) return 0;
+
+    float density = S->obstacle_density;
+    if (density < 0.0f) density = 0.0f;
+    if (density > 0.8f) density = 0.8f;
+
+    fill_parallel(S->obstacles, S->world_w, S->world_h, density, S->seed);
+    if (repair_components(S->obstacles, S->world_w, S->world_h)) {
+        size_t blocked = top_up_density(S->obstacles, S->world_w, S->world_h, density, S->seed);
+        if (check_reachability(S->world_w, S->world_h, S->obstacles)) {
+            double reached = (double)blocked / (double)count;
+            if (reached + (double)OBSTACLE_DENSITY_TOL < (double)density) {
+                fprintf(stderr, "Warning: obstacle density %.3f instead of %.2f; no more cells could be "
+                        "blocked without cutting others off.\n", reached, (double)density);
+            }
+            return 1;
+        }
+    }
+    fprintf(stderr,"Faild to find world with full reachability and with obstacle density %.2f.\n",density);
+    fflush(stderr);
+    free(S->obstacles);
+    S->obstacles = NULL;
+    return 0;
+}
+
+int init_obstacles(Server *S) {
+    if (!S->obstacle_mode) return 1;
+
+    if (S->obstacle_mode == 2) {
+        uint8_t *obs = NULL;
+        int loaded;
+        if (obstacles_is_pbm(S->obstacle_file)) {
+            loaded = load_obstacles_pbm(S->obstacle_file, &S->world_w, &S->world_h, &obs);
+        } else {
+            loaded = load_obstacles_file(S->obstacle_file, S->world_w, S->world_h, &obs);
+        }
+        if (!loaded) {
+            fprintf(stderr, "Failed to load obstacle file %s\n", S->obstacle_file);
+            return 0;
+        }
+        int cx = S->world_w / 2;
+        int cy = S->world_h / 2;
+        if (obs[(size_t)cy * (size_t)S->world_w + (size_t)cx]) {
+            fprintf(stderr, "Obstacle at center is not allowed.\n");
+            free(obs);
+            return 0;
+        }
+        if (!check_reachability(S->world_w, S->world_h, obs)) {
+            fprintf(stderr, "Obstacle world is not fully reachable from [0,0].\n");
+            free(obs);
+            return 0;
+        }
+        S->obstacles = obs;
+        S->obstacle_density = 0.0f;
+        return 1;
+    }
+
+    return generate_random_obstacles(S);
+}
+
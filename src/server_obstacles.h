@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "server_types.h"
+
+#define OBSTACLE_DENSITY_TOL 0.01f
+#define OBSTACLE_MAX_THREADS 8
+#define OBSTACLE_MIN_BAND_ROWS 64
+#define OBSTACLE_REPAIR_RADIUS 8
+
+size_t reachability_row_words(int w);
+int reachability_map(int w, int h, const uint8_t *obs, uint64_t *out_bits);
+int check_reachability(int w, int h, const uint8_t *obs);
+int obstacles_is_pbm(const char *path);
+size_t obstacles_pack(const uint8_t *obs, size_t count, uint8_t *out_bits);
+int init_obstacles(Server *S);
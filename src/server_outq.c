@@ -0,0 +1,150 @@
+#include "server_outq.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "shared.h"
+
+Frame *frame_alloc(uint32_t type, size_t size) {
+    Frame *f = (Frame*)malloc(sizeof(Frame) + size);
+    if (!f) return NULL;
+    atomic_init(&f->refs, 1);
+    f->type = type;
+    f->size = size;
+    return f;
+}
+
+Frame *frame_new(uint32_t type, const void *payload, uint32_t len) {
+    Frame *f = frame_alloc(type, sizeof(MsgHdr) + len);
+    if (!f) return NULL;
+    MsgHdr h = { type, len };
+    memcpy(f->data, &h, sizeof(h));
+    if (len) memcpy(f->data + sizeof(h), payload, len);
+    return f;
+}
+
+void frame_ref(Frame *f) {
+    atomic_fetch_add_explicit(&f->refs, 1, memory_order_relaxed);
+}
+
+void frame_unref(Frame *f) {
+    if (f && atomic_fetch_sub_explicit(&f->refs, 1, memory_order_acq_rel) == 1) free(f);
+}
+
+void outq_config_env(OutqConfig *cfg) {
+    const char *policy = getenv("RW_CLIENT_OVERFLOW");
+    const char *frames = getenv("RW_CLIENT_QUEUE");
+    const char *bytes = getenv("RW_CLIENT_QUEUE_BYTES");
+    cfg->policy = OUTQ_COALESCE;
+    if (policy && *policy) {
+        if (strcasecmp(policy, "drop") == 0) {
+            cfg->policy = OUTQ_DROP;
+        } else if (strcasecmp(policy, "disconnect") == 0) {
+            cfg->policy = OUTQ_DISCONNECT;
+        } else if (strcasecmp(policy, "coalesce") != 0) {
+            fprintf(stderr, "RW_CLIENT_OVERFLOW=%s unknown; using coalesce.\n", policy);
+        }
+    }
+    cfg->max_frames = (frames && *frames) ? atoi(frames) : OUTQ_DEFAULT_FRAMES;
+    if (cfg->max_frames < 1) cfg->max_frames = 1;
+    cfg->max_bytes = (bytes && *bytes) ? (size_t)strtoull(bytes, NULL, 10) : OUTQ_DEFAULT_BYTES;
+}
+
+int outq_init(OutQueue *q) {
+    memset(q, 0, sizeof(*q));
+    q->slots = (Frame**)malloc(OUTQ_MIN_SLOTS * sizeof(*q->slots));
+    if (!q->slots) return 0;
+    q->cap = OUTQ_MIN_SLOTS;
+    pthread_mutex_init(&q->mtx, NULL);
+    return 1;
+}
+
+void outq_free(OutQueue *q) {
+    for (int i = 0; i < q->count; i++) frame_unref(q->slots[(q->head + i) % q->cap]);
+    free(q->slots);
+    q->slots = NULL;
+    q->count = 0;
+    pthread_mutex_destroy(&q->mtx);
+}
+
+static int outq_grow(OutQueue *q) {
+    int cap = q->cap * 2;
+    Frame **slots = (Frame**)malloc((size_t)cap * sizeof(*slots));
+    if (!slots) return 0;
+    for (int i = 0; i < q->count; i++) slots[i] = q->slots[(q->head + i) % q->cap];
+    free(q->slots);
+    q->slots = slots;
+    q->cap = cap;
+    q->head = 0;
+    return 1;
+}
+
+// Replaces the newest queued frame of f's type. Queued frames are all
+// still unsent; the loop takes a frame out before writing it.
+static int outq_coalesce(OutQueue *q, Frame *f) {
+    for (int i = q->count - 1; i >= 0; i--) {
+        Frame **slot = &q->slots[(q->head + i) % q->cap];
+        if ((*slot)->type != f->type) continue;
+        q->bytes = q->bytes - (*slot)->size + f->size;
+        frame_unref(*slot);
+        frame_ref(f);
+        *slot = f;
+        return 1;
+    }
+    return 0;
+}
+
+// Returns 0 once the queue is closed; the caller then drops the client.
+int outq_push(OutQueue *q, const OutqConfig *cfg, Frame *f, int force) {
+    pthread_mutex_lock(&q->mtx);
+    if (q->closed) {
+        pthread_mutex_unlock(&q->mtx);
+        return 0;
+    }
+    int full = q->count >= cfg->max_frames ||
+               (q->count > 0 && q->bytes + f->size > cfg->max_bytes);
+    if (full && !force) {
+        int latest = (f->type == MSG_PROGRESS || f->type == MSG_STATS);
+        if (cfg->policy == OUTQ_DISCONNECT) {
+            fprintf(stderr, "Client queue full (%d frames, %zu bytes); disconnecting it.\n",
+                    q->count, q->bytes);
+            q->closed = 1;
+            pthread_mutex_unlock(&q->mtx);
+            return 0;
+        }
+        if (f->type == MSG_STEP || f->type == MSG_STEPS || (latest && cfg->policy == OUTQ_DROP) ||
+            (latest && outq_coalesce(q, f))) {
+            q->dropped++;
+            pthread_mutex_unlock(&q->mtx);
+            return 1;
+        }
+    }
+    if (q->count == q->cap && !outq_grow(q)) {
+        q->closed = 1;
+        pthread_mutex_unlock(&q->mtx);
+        return 0;
+    }
+    frame_ref(f);
+    q->slots[(q->head + q->count) % q->cap] = f;
+    q->count++;
+    q->bytes += f->size;
+    pthread_mutex_unlock(&q->mtx);
+    return 1;
+}
+
+// 1 with the oldest frame in *out, 0 when empty or when that frame is
+// larger than max, -1 once closed.
+int outq_take(OutQueue *q, size_t max, Frame **out) {
+    pthread_mutex_lock(&q->mtx);
+    int rc = q->closed ? -1 : (q->count > 0 && q->slots[q->head]->size <= max);
+    if (rc > 0) {
+        *out = q->slots[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        q->bytes -= (*out)->size;
+    }
+    pthread_mutex_unlock(&q->mtx);
+    return rc;
+}
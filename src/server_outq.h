@@ -0,0 +1,55 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUTQ_DEFAULT_FRAMES 4096
+#define OUTQ_DEFAULT_BYTES (16u << 20)
+#define OUTQ_MIN_SLOTS 16
+
+// What a full queue does with a new frame. Control frames (welcome, mode,
+// obstacles, greeting) are always queued under drop and coalesce.
+typedef enum {
+    OUTQ_DROP,       // drop steps, progress and stats
+    OUTQ_COALESCE,   // drop steps; progress/stats replace the newest queued one
+    OUTQ_DISCONNECT, // cut the client off
+} OutqPolicy;
+
+typedef struct {
+    OutqPolicy policy;
+    int max_frames;
+    size_t max_bytes;
+} OutqConfig;
+
+// One serialized message (header and payload), shared by every queue it
+// sits in and freed with its last reference.
+typedef struct Frame {
+    atomic_int refs;
+    uint32_t type;
+    size_t size;
+    uint8_t data[];
+} Frame;
+
+typedef struct {
+    pthread_mutex_t mtx;
+    Frame **slots;
+    int cap;
+    int head;
+    int count;
+    size_t bytes;
+    int closed;
+    uint64_t dropped;
+} OutQueue;
+
+Frame *frame_alloc(uint32_t type, size_t size);
+Frame *frame_new(uint32_t type, const void *payload, uint32_t len);
+void frame_ref(Frame *f);
+void frame_unref(Frame *f);
+
+void outq_config_env(OutqConfig *cfg);
+int outq_init(OutQueue *q);
+void outq_free(OutQueue *q);
+int outq_push(OutQueue *q, const OutqConfig *cfg, Frame *f, int force);
+int outq_take(OutQueue *q, size_t max, Frame **out);
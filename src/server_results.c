@@ -0,0 +1,139 @@
+#include "server_results.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int write_results_snapshot(const char *path, const ResultsSnapshot *s, void *ctx) {
+    (void)ctx;
+    return results_is_csv_path(path)
+        ? results_write_csv(path, &s->meta, s->hits, s->steps)
+        : results_write_binary(path, &s->meta, s->hits, s->steps);
+}
+
+static void *writer_thread(void *arg) {
+    ResultsWriter *w = (ResultsWriter*)arg;
+
+    pthread_mutex_lock(&w->mtx);
+    for (;;) {
+        while (w->pending < 0 && !w->stop) {
+            pthread_cond_wait(&w->cv, &w->mtx);
+        }
+        if (w->pending < 0) break;
+
+        int idx = w->pending;
+        w->pending = -1;
+        w->writing = idx;
+        pthread_mutex_unlock(&w->mtx);
+
+        ResultsSnapshot *s = &w->buf[idx];
+        if (!w->write_fn(w->path, s, w->write_ctx)) {
+            perror(w->path);
+        }
+
+        pthread_mutex_lock(&w->mtx);
+        w->writing = -1;
+        pthread_cond_broadcast(&w->cv);
+    }
+    pthread_mutex_unlock(&w->mtx);
+    return NULL;
+}
+
+int results_writer_start(ResultsWriter *w, const char *path, size_t count,
+                         SnapshotWriteFn write_fn, void *write_ctx) {
+    memset(w, 0, sizeof(*w));
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    w->write_fn = write_fn ? write_fn : write_results_snapshot;
+    w->write_ctx = write_ctx;
+    w->count = count;
+    w->pending = -1;
+    w->writing = -1;
+    for (int i = 0; i < 2; i++) {
+        w->buf[i].hits = (uint32_t*)calloc(count, sizeof(uint32_t));
+        w->buf[i].steps = (uint64_t*)calloc(count, sizeof(uint64_t));
+        if (!w->buf[i].hits || !w->buf[i].steps) {
+            results_writer_finish(w);
+            return 0;
+        }
+    }
+    pthread_mutex_init(&w->mtx, NULL);
+    pthread_cond_init(&w->cv, NULL);
+    if (pthread_create(&w->th, NULL, writer_thread, w) != 0) {
+        results_writer_finish(w);
+        return 0;
+    }
+    w->started = 1;
+    return 1;
+}
+
+void results_writer_submit(ResultsWriter *w, const ResultsMeta *meta,
+                           uint32_t *const *hits, uint64_t *const *steps,
+                           const SimCursor *cursor) {
+    if (!w->started) return;
+
+    pthread_mutex_lock(&w->mtx);
+    int idx = (w->writing == 0) ? 1 : 0;
+    w->pending = -1;
+    pthread_mutex_unlock(&w->mtx);
+
+    ResultsSnapshot *s = &w->buf[idx];
+    s->meta = *meta;
+    if (cursor) {
+        s->cursor = *cursor;
+    } else {
+        memset(&s->cursor, 0, sizeof(s->cursor));
+    }
+    memcpy(s->hits, hits[0], w->count * sizeof(*s->hits));
+    memcpy(s->steps, steps[0], w->count * sizeof(*s->steps));
+
+    pthread_mutex_lock(&w->mtx);
+    w->pending = idx;
+    pthread_cond_broadcast(&w->cv);
+    pthread_mutex_unlock(&w->mtx);
+}
+
+void results_writer_drain(ResultsWriter *w) {
+    if (!w->started) return;
+    pthread_mutex_lock(&w->mtx);
+    while (w->pending >= 0 || w->writing >= 0) {
+        pthread_cond_wait(&w->cv, &w->mtx);
+    }
+    pthread_mutex_unlock(&w->mtx);
+}
+
+// Keeps the thread and buffers when the grid size is unchanged.
+int results_writer_reset(ResultsWriter *w, const char *path, size_t count,
+                         SnapshotWriteFn write_fn, void *write_ctx) {
+    if (!w->started || w->count != count) {
+        results_writer_finish(w);
+        return results_writer_start(w, path, count, write_fn, write_ctx);
+    }
+    pthread_mutex_lock(&w->mtx);
+    while (w->pending >= 0 || w->writing >= 0) {
+        pthread_cond_wait(&w->cv, &w->mtx);
+    }
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    w->write_fn = write_fn ? write_fn : write_results_snapshot;
+    w->write_ctx = write_ctx;
+    pthread_mutex_unlock(&w->mtx);
+    return 1;
+}
+
+void results_writer_finish(ResultsWriter *w) {
+    if (w->started) {
+        pthread_mutex_lock(&w->mtx);
+        w->stop = 1;
+        pthread_cond_broadcast(&w->cv);
+        pthread_mutex_unlock(&w->mtx);
+        pthread_join(w->th, NULL);
+        pthread_mutex_destroy(&w->mtx);
+        pthread_cond_destroy(&w->cv);
+        w->started = 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        free(w->buf[i].hits);
+        free(w->buf[i].steps);
+        w->buf[i].hits = NULL;
+        w->buf[i].steps = NULL;
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "results_io.h"
+
+typedef struct {
+    int replications;
+    int base_replications;
+    int rep_begin;
+    int rep_end;
+    uint64_t next_cell;
+    uint64_t seed;
+    uint64_t rng_state;
+} SimCursor;
+
+typedef struct {
+    uint32_t *hits;
+    uint64_t *steps;
+    ResultsMeta meta;
+    SimCursor cursor;
+} ResultsSnapshot;
+
+typedef int (*SnapshotWriteFn)(const char *path, const ResultsSnapshot *s, void *ctx);
+
+typedef struct {
+    char path[256];
+    size_t count;
+    ResultsSnapshot buf[2];
+    int pending;
+    int writing;
+    int stop;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+    pthread_t th;
+    int started;
+    SnapshotWriteFn write_fn;
+    void *write_ctx;
+} ResultsWriter;
+
+int results_writer_start(ResultsWriter *w, const char *path, size_t count,
+                         SnapshotWriteFn write_fn, void *write_ctx);
+void results_writer_submit(ResultsWriter *w, const ResultsMeta *meta,
+                           uint32_t *const *hits, uint64_t *const *steps,
+                           const SimCursor *cursor);
+void results_writer_drain(ResultsWriter *w);
+int results_writer_reset(ResultsWriter *w, const char *path, size_t count,
+                         SnapshotWriteFn write_fn, void *write_ctx);
+void results_writer_finish(ResultsWriter *w);
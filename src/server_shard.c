@@ -0,0 +1,248 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "server_shard.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "protocol.h"
+#include "server_net.h"
+#include "server_sim.h"
+
+#define SHARD_POLL_MS 100
+
+// Sent by a worker after each block, followed by the block's w*h hit counts
+// and w*h step sums.
+typedef struct {
+    uint32_t block;
+    uint32_t reps;
+} ShardResult;
+
+typedef struct {
+    pid_t pid;
+    int fd;
+    int block;
+    int failed;
+    int restarts;
+} ShardProc;
+
+static int block_reps(const Server *S, int block) {
+    int left = S->replications - S->cached_replications - block * SHARD_REP_BLOCK;
+    return (left < SHARD_REP_BLOCK) ? left : SHARD_REP_BLOCK;
+}
+
+static uint64_t block_seed(const Server *S, int block) {
+    uint64_t first_rep = (uint64_t)(S->base_replications + S->cached_replications) +
+                         (uint64_t)block * SHARD_REP_BLOCK;
+    return S->seed ^ ((first_rep + 1u) * 0xD1B54A32D192ED03ull);
+}
+
+static void shard_worker(const Server *S, const uint8_t *obstacles, int fd) {
+    sigset_t none;
+    sigemptyset(&none);
+    pthread_sigmask(SIG_SETMASK, &none, NULL);
+
+    // Client sockets and the listener stay with the coordinator.
+    if (dup2(fd, 3) < 0) _exit(1);
+    closefrom(4);
+    fd = 3;
+
+    RwWorld *W = rwalk_world_create(S->world_w, S->world_h, S->max_steps,
+                                    S->pU, S->pD, S->pL, S->pR);
+    if (!W) _exit(1);
+    rwalk_world_set_obstacles(W, obstacles);
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+
+    uint32_t block;
+    while (recv_all(fd, &block, sizeof(block)) > 0) {
+        ShardResult r = { .block = block, .reps = (uint32_t)block_reps(S, (int)block) };
+        rwalk_world_reset(W);
+        rwalk_world_seed(W, block_seed(S, (int)block));
+        if (!rwalk_run(W, (int)r.reps, RW_KERNEL_AUTO, 1)) _exit(1);
+        if (send_all(fd, &r, sizeof(r)) != 0 ||
+            send_all(fd, rwalk_hits(W), count * sizeof(uint32_t)) != 0 ||
+            send_all(fd, rwalk_steps(W), count * sizeof(uint64_t)) != 0) {
+            _exit(1);
+        }
+    }
+    _exit(0);
+}
+
+static int shard_spawn(Server *S, const uint8_t *obstacles, ShardProc *p) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        perror("socketpair");
+        return 0;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return 0;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        shard_worker(S, obstacles, sv[1]);
+    }
+    close(sv[1]);
+    p->pid = pid;
+    p->fd = sv[0];
+    p->block = -1;
+    p->failed = 0;
+    return 1;
+}
+
+static void shard_reap(ShardProc *p, int kill_it) {
+    if (p->fd < 0) return;
+    if (kill_it) kill(p->pid, SIGKILL);
+    close(p->fd);
+    while (waitpid(p->pid, NULL, 0) < 0 && errno == EINTR) {}
+    p->fd = -1;
+    p->block = -1;
+}
+
+static int recv_result(Server *S, ShardProc *p, uint32_t *hits, uint64_t *steps) {
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+    ShardResult r;
+    if (recv_all(p->fd, &r, sizeof(r)) <= 0 || (int)r.block != p->block ||
+        recv_all(p->fd, hits, count * sizeof(*hits)) <= 0 ||
+        recv_all(p->fd, steps, count * sizeof(*steps)) <= 0) {
+        return 0;
+    }
+    uint32_t *acc_hits = S->succesful_replications[0];
+    uint64_t *acc_steps = S->steps_to_center[0];
+    for (size_t i = 0; i < count; i++) {
+        acc_hits[i] += hits[i];
+        acc_steps[i] += steps[i];
+    }
+    return (int)r.reps;
+}
+
+void shard_run(Server *S) {
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+    int nblocks = (S->replications - S->cached_replications + SHARD_REP_BLOCK - 1) / SHARD_REP_BLOCK;
+    int nshards = (S->shards > SHARD_MAX) ? SHARD_MAX : S->shards;
+    if (nshards > nblocks) nshards = nblocks;
+
+    if (S->budget_secs > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &S->deadline);
+        S->deadline.tv_sec += S->budget_secs;
+    }
+
+    // Workers see the map through one read-only shared mapping.
+    uint8_t *obstacles = NULL;
+    if (S->obstacles && nblocks > 0) {
+        obstacles = mmap(NULL, count, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (obstacles == MAP_FAILED) {
+            perror("mmap obstacles");
+            sim_finish(S, 0);
+            return;
+        }
+        memcpy(obstacles, S->obstacles, count);
+        mprotect(obstacles, count, PROT_READ);
+    }
+
+    uint32_t *hits = (uint32_t*)malloc(count * sizeof(*hits));
+    uint64_t *steps = (uint64_t*)malloc(count * sizeof(*steps));
+    int *todo = (int*)malloc((size_t)(nblocks + 1) * sizeof(*todo));
+    ShardProc procs[SHARD_MAX];
+    int ntodo = 0, live = 0, done_blocks = 0, done_reps = S->cached_replications;
+    if (!hits || !steps || !todo) {
+        perror("shard buffers");
+        nshards = 0;
+    }
+    for (int b = nblocks - 1; todo && b >= 0; b--) todo[ntodo++] = b;
+    for (int i = 0; i < nshards; i++) {
+        procs[i].fd = -1;
+        procs[i].restarts = 0;
+        if (shard_spawn(S, obstacles, &procs[i])) live++;
+    }
+    if (nshards > 0) {
+        fprintf(stdout, "Sharded run: %d workers, %d blocks of %d replications\n",
+                live, nblocks, SHARD_REP_BLOCK);
+        fflush(stdout);
+    }
+
+    // Blocks still running at a budget deadline are dropped with their workers.
+    while (done_blocks < nblocks && live > 0 && atomic_load(&S->running) &&
+           !sim_past_deadline(S)) {
+        struct pollfd pfd[SHARD_MAX];
+        for (int i = 0; i < nshards; i++) {
+            ShardProc *p = &procs[i];
+            if (p->fd >= 0 && p->block < 0 && ntodo > 0) {
+                uint32_t b = (uint32_t)todo[--ntodo];
+                p->block = (int)b;
+                if (send_all(p->fd, &b, sizeof(b)) != 0) p->failed = 1;
+            }
+            pfd[i].fd = p->fd;
+            pfd[i].events = POLLIN;
+            pfd[i].revents = 0;
+        }
+        if (poll(pfd, (nfds_t)nshards, SHARD_POLL_MS) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        sim_flush_stats(S, done_reps, NULL);
+        for (int i = 0; i < nshards; i++) {
+            ShardProc *p = &procs[i];
+            if (p->fd < 0) continue;
+            int failed = p->failed;
+            if (!failed && p->block >= 0 && (pfd[i].revents & POLLIN)) {
+                int reps = recv_result(S, p, hits, steps);
+                if (reps > 0) {
+                    p->block = -1;
+                    done_blocks++;
+                    done_reps += reps;
+                    atomic_store(&S->current_replication, done_reps);
+                    server_progress(S, (uint32_t)done_reps, (uint32_t)S->replications);
+                    sim_publish(S, done_reps);
+                    continue;
+                }
+                failed = 1;
+            } else if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                failed = 1;
+            }
+            if (!failed) continue;
+
+            // The worker died or broke protocol; its block goes back in the queue.
+            if (p->block >= 0) todo[ntodo++] = p->block;
+            pid_t pid = p->pid;
+            shard_reap(p, 1);
+            live--;
+            if (p->restarts >= SHARD_MAX_RESTARTS) {
+                fprintf(stderr, "Shard %d (pid %d) failed; giving up on it.\n", i, (int)pid);
+            } else if (shard_spawn(S, obstacles, p)) {
+                p->restarts++;
+                live++;
+                fprintf(stderr, "Shard %d (pid %d) failed; restarted as pid %d.\n",
+                        i, (int)pid, (int)p->pid);
+            }
+        }
+    }
+    if (live == 0 && done_blocks < nblocks && atomic_load(&S->running)) {
+        fprintf(stderr, "Sharded run aborted: no workers left.\n");
+    }
+
+    for (int i = 0; i < nshards; i++) shard_reap(&procs[i], 1);
+    free(hits);
+    free(steps);
+    free(todo);
+    if (obstacles) munmap(obstacles, count);
+
+    int budget_hit = done_blocks < nblocks && sim_past_deadline(S) && atomic_load(&S->running);
+    if (budget_hit) {
+        sim_budget_reached(S, done_reps);
+    }
+    atomic_store(&S->current_replication, done_reps);
+    sim_finish(S, done_blocks == nblocks || budget_hit);
+}
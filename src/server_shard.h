@@ -0,0 +1,14 @@
+#pragma once
+
+#include "server_types.h"
+
+#define SHARD_MAX 64
+#define SHARD_REP_BLOCK 8
+#define SHARD_MAX_RESTARTS 3
+
+// Coordinator mode: the job is cut into blocks of SHARD_REP_BLOCK
+// replications over every spawn cell, and S->shards forked workers run them
+// with librwalk. Each block has its own seed, so results do not depend on
+// how many workers there are, which worker ran a block, or whether it had to
+// be run twice after a crash.
+void shard_run(Server *S);
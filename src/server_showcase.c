@@ -0,0 +1,175 @@
+#include "server_showcase.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "server_net.h"
+#include "step_batch.h"
+
+typedef struct {
+    Rng rng;
+    int jobs;
+    int walking;
+    int x, y;
+    int step;
+    // Steps not sent yet. run[0] is the last one clients have, unless
+    // run_new marks it as the spawn of a walk they have not seen.
+    MsgStep run[SHOWCASE_RUN_MAX + 1];
+    uint8_t dirs[SHOWCASE_RUN_MAX + 1];
+    int run_len;
+    int run_new;
+    uint64_t unsent_ns;
+    uint8_t payload[STEPS_PAYLOAD_MAX(SHOWCASE_RUN_MAX)];
+} ShowcaseWalk;
+
+static void ts_add_ns(struct timespec *t, uint64_t ns) {
+    t->tv_sec += (time_t)(ns / 1000000000ull);
+    t->tv_nsec += (long)(ns % 1000000000ull);
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+static int watched(Server *S) {
+    return atomic_load(&S->running) && atomic_load(&S->mode) == MODE_INTERACTIVE &&
+           server_wants(S, STREAM_STEPS);
+}
+
+// Any free cell but the centre, like the engine's spawn cells.
+static void pick_spawn(Server *S, ShowcaseWalk *w) {
+    int cx = S->world_w / 2, cy = S->world_h / 2;
+    uint64_t count = (uint64_t)S->world_w * (uint64_t)S->world_h;
+    uint64_t idx = rng_next(&w->rng) % count;
+    for (uint64_t tries = 0; tries < count; tries++, idx = (idx + 1 == count) ? 0 : idx + 1) {
+        int x = (int)(idx % (uint64_t)S->world_w);
+        int y = (int)(idx / (uint64_t)S->world_w);
+        if ((x == cx && y == cy) || (S->obstacles && S->obstacles[idx])) continue;
+        w->x = x;
+        w->y = y;
+        return;
+    }
+    w->x = cx;
+    w->y = cy;
+}
+
+// Sends the pending steps as one run and records them in the history, so
+// the history holds exactly what clients were sent. Caller holds
+// showcase_mtx.
+static void showcase_flush(Server *S, ShowcaseWalk *w) {
+    w->unsent_ns = 0;
+    if (w->run_len == 0 || (w->run_len == 1 && !w->run_new)) return;
+    if (w->run_new) history_begin(&S->history, w->run[0]);
+    for (int i = 1; i < w->run_len; i++) history_push(&S->history, w->dirs[i], w->run[i]);
+    uint32_t len = steps_encode(w->run, w->run_len, w->run_new, S->world_w, S->world_h, w->payload);
+    clients_broadcast(S, MSG_STEPS, w->payload, len);
+    w->run[0] = w->run[w->run_len - 1];
+    w->run_len = 1;
+    w->run_new = 0;
+}
+
+// Caller holds showcase_mtx. Returns 0 when there is nothing to show.
+static int showcase_steps(Server *S, ShowcaseWalk *w, int n) {
+    if (!S->walk || S->restarting || !watched(S)) {
+        w->walking = 0;
+        w->run_len = 0;
+        return 0;
+    }
+    if (w->jobs != S->jobs) {
+        w->jobs = S->jobs;
+        w->walking = 0;
+        w->run_len = 0;
+        rng_seed(&w->rng, S->seed, UINT64_MAX);
+    }
+    int cx = S->world_w / 2, cy = S->world_h / 2;
+    for (int i = 0; i < n; i++) {
+        if (!w->walking) {
+            showcase_flush(S, w);
+            pick_spawn(S, w);
+            w->step = 0;
+            w->walking = 1;
+            w->run[0] = (MsgStep){ .x = w->x, .y = w->y, .step_index = 0 };
+            w->run_len = 1;
+            w->run_new = 1;
+            atomic_store(&S->current_step, 0);
+            continue;
+        }
+        if (w->run_len > SHOWCASE_RUN_MAX) showcase_flush(S, w);
+        int dir = rwalk_step(S->walk, &w->rng, &w->x, &w->y);
+        w->step++;
+        w->run[w->run_len] = (MsgStep){ .x = w->x, .y = w->y, .step_index = (uint32_t)w->step };
+        w->dirs[w->run_len] = (uint8_t)dir;
+        w->run_len++;
+        atomic_store(&S->current_step, w->step);
+        if ((w->x == cx && w->y == cy) || w->step >= S->max_steps) w->walking = 0;
+    }
+    return 1;
+}
+
+static void *showcase_thread(void *arg) {
+    Server *S = (Server*)arg;
+    ShowcaseWalk *w = (ShowcaseWalk*)calloc(1, sizeof(*w));
+    if (!w) {
+        fprintf(stderr, "Showcase walker out of memory; interactive viewers get no steps.\n");
+        return NULL;
+    }
+    w->jobs = -1;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (atomic_load(&S->showcase_on)) {
+        // Delays under a tick are paced as several steps per tick.
+        uint64_t step_ns = (S->showcase_delay_us >= 0)
+                               ? (uint64_t)S->showcase_delay_us * 1000ull
+                               : (uint64_t)S->step_delay_ms * 1000000ull;
+        int batch = SHOWCASE_MAX_BATCH;
+        if (step_ns > 0) {
+            uint64_t per_tick = (uint64_t)SHOWCASE_TICK_US * 1000ull / step_ns;
+            batch = (per_tick < 1) ? 1 : (per_tick > SHOWCASE_MAX_BATCH) ? SHOWCASE_MAX_BATCH : (int)per_tick;
+        }
+        uint64_t tick_ns = (step_ns > 0) ? step_ns * (uint64_t)batch : SHOWCASE_TICK_US * 1000ull;
+
+        pthread_mutex_lock(&S->showcase_mtx);
+        int active = showcase_steps(S, w, batch);
+        w->unsent_ns += tick_ns;
+        if (active && w->unsent_ns >= SHOWCASE_FLUSH_US * 1000ull) showcase_flush(S, w);
+        server_progress_flush(S);
+        pthread_mutex_unlock(&S->showcase_mtx);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!active) {
+            next = now;
+            ts_add_ns(&next, SHOWCASE_IDLE_MS * 1000000ull);
+        } else {
+            ts_add_ns(&next, tick_ns);
+            // After a stall, carry on from now instead of bursting to catch up.
+            if (now.tv_sec > next.tv_sec + 1) next = now;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0 &&
+               atomic_load(&S->showcase_on)) {}
+    }
+    free(w);
+    return NULL;
+}
+
+int showcase_start(Server *S) {
+    const char *delay = getenv("RW_STEP_DELAY_US");
+    S->showcase_delay_us = (delay && *delay) ? atoi(delay) : -1;
+    pthread_mutex_init(&S->showcase_mtx, NULL);
+    atomic_store(&S->showcase_on, 1);
+    if (pthread_create(&S->showcase_th, NULL, showcase_thread, S) != 0) {
+        atomic_store(&S->showcase_on, 0);
+        fprintf(stderr, "Showcase walker not started; interactive viewers get no steps.\n");
+        return 0;
+    }
+    return 1;
+}
+
+void showcase_stop(Server *S) {
+    if (atomic_exchange(&S->showcase_on, 0)) {
+        pthread_join(S->showcase_th, NULL);
+    }
+    pthread_mutex_destroy(&S->showcase_mtx);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "server_types.h"
+
+#define SHOWCASE_TICK_US 1000
+#define SHOWCASE_MAX_BATCH 256
+#define SHOWCASE_IDLE_MS 20
+#define SHOWCASE_FLUSH_US 16000
+#define SHOWCASE_RUN_MAX 4096
+
+// The walk interactive viewers watch. It runs on its own thread with the
+// job's world and step kernel, from random spawn cells, paced by the step
+// delay, while the replications that count run unpaced elsewhere. Steps
+// go out as MSG_STEPS runs about once a frame (SHOWCASE_FLUSH_US).
+int showcase_start(Server *S);
+void showcase_stop(Server *S);
@@ -1,13 +1,21 @@
 #include "server_sim.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "server_net.h"
+#include "server_checkpoint.h"
+#include "server_cache.h"
+#include "server_job.h"
+#include "server_shard.h"
 
-static float get_random(void) { return (float)rand() / (float)RAND_MAX; }
+#define SIM_TILE 32
+#define SIM_REP_BLOCK 16
+#define BUDGET_MIN_ROUND_MS 200
+#define BUDGET_MAX_ROUND_MS 10000
 
 static int is_obstacle(const Server *S, int x, int y) {
     if (!S->obstacles) return 0;
@@ -15,55 +23,128 @@ static int is_obstacle(const Server *S, int x, int y) {
     return S->obstacles[idx] != 0;
 }
 
-static void write_results(Server *S) {
-    if (!S->results_fp) return;
+static int slice_expired(const Server *S) {
+    if (!S->slice_active) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec != S->slice_end.tv_sec) return now.tv_sec > S->slice_end.tv_sec;
+    return now.tv_nsec >= S->slice_end.tv_nsec;
+}
 
-    int reps = atomic_load(&S->current_replication);
-    if (reps <= 0) return;
+static double secs_until(const struct timespec *t) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(t->tv_sec - now.tv_sec) + (double)(t->tv_nsec - now.tv_nsec) * 1e-9;
+}
 
-    const char *ob_file = (S->obstacle_file[0] != '\0') ? S->obstacle_file : "-";
-    fprintf(S->results_fp, "%d,%d,%.6f,%.6f,%.6f,%.6f,%d,%d,%d,%.6f,%s,%s\n",
-            S->world_w, S->world_h, S->pU, S->pD, S->pL, S->pR,
-            S->max_steps, S->base_replications + reps,
-            S->obstacle_mode, S->obstacle_density,
-            ob_file, S->sock_path);
+int sim_past_deadline(const Server *S) {
+    return S->budget_secs > 0 && secs_until(&S->deadline) <= 0.0;
+}
 
-    for (int y = 0; y < S->world_h; y++) {
-        for (int x = 0; x < S->world_w; x++) {
-            float prob = S->prob_to_center[y][x];
-            if (prob <= 0.0f) continue;
-            float avg = S->avg_steps_to_center[y][x];
-            fprintf(S->results_fp, "%d,%d,%.6f,%.6f\n", x, y, prob, avg);
-        }
-    }
-    fflush(S->results_fp);
+// A budgeted round is only abandoned at the deadline if it can be undone.
+static int round_cut(const Server *S) {
+    return S->round_saved && sim_past_deadline(S);
 }
 
-static void compute_and_send_stats(Server *S, int current_replication) {
-    if (current_replication <= 0) return;
+// Replications for the next budgeted round: about a quarter of the time
+// left, from the measured cost of one replication over the grid. Returns 0
+// once no further replication fits before the deadline.
+static int budget_plan(Server *S, int rep_begin) {
+    double left = secs_until(&S->deadline);
+    int cap = S->replications - rep_begin;
+    if (left <= 0.0 || cap <= 0) return 0;
+    if (S->rep_secs <= 0.0) return 1;
+    if (S->rep_secs > left) return 0;
+
+    double target = left / 4.0;
+    if (target < BUDGET_MIN_ROUND_MS / 1000.0) target = BUDGET_MIN_ROUND_MS / 1000.0;
+    if (target > BUDGET_MAX_ROUND_MS / 1000.0) target = BUDGET_MAX_ROUND_MS / 1000.0;
+    if (target > left) target = left;
+    double reps = target / S->rep_secs;
+    if (reps < 1.0) return 1;
+    return (reps > (double)cap) ? cap : (int)reps;
+}
 
+static void round_save(Server *S) {
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+    S->round_saved = S->round_hits && S->round_steps;
+    if (!S->round_saved) return;
+    memcpy(S->round_hits, S->succesful_replications[0], count * sizeof(*S->round_hits));
+    memcpy(S->round_steps, S->steps_to_center[0], count * sizeof(*S->round_steps));
+}
+
+static void round_restore(Server *S) {
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+    memcpy(S->succesful_replications[0], S->round_hits, count * sizeof(*S->round_hits));
+    memcpy(S->steps_to_center[0], S->round_steps, count * sizeof(*S->round_steps));
+    S->round_saved = 0;
+}
+
+static void write_results(Server *S, int reps) {
+    if (S->base_replications + reps <= 0) return;
+
+    ResultsMeta m;
+    memset(&m, 0, sizeof(m));
+    m.world_w = S->world_w;
+    m.world_h = S->world_h;
+    m.pU = S->pU; m.pD = S->pD; m.pL = S->pL; m.pR = S->pR;
+    m.max_steps = S->max_steps;
+    m.replications = S->base_replications + reps;
+    m.obstacle_mode = S->obstacle_mode;
+    m.obstacle_density = S->obstacle_density;
+    snprintf(m.obstacle_file, sizeof(m.obstacle_file), "%s", S->obstacle_file);
+    snprintf(m.sock_path, sizeof(m.sock_path), "%s", S->sock_path);
+    results_writer_submit(&S->writer, &m, S->succesful_replications, S->steps_to_center, NULL);
+}
+
+// Position of a cell in run_block's tiled order.
+static uint64_t tile_order(const Server *S, int x, int y) {
+    int ty = y / SIM_TILE * SIM_TILE;
+    int tx = x / SIM_TILE * SIM_TILE;
+    int band_h = (ty + SIM_TILE < S->world_h) ? SIM_TILE : S->world_h - ty;
+    int tile_w = (tx + SIM_TILE < S->world_w) ? SIM_TILE : S->world_w - tx;
+    return (uint64_t)ty * (uint64_t)S->world_w + (uint64_t)tx * (uint64_t)band_h +
+           (uint64_t)(y - ty) * (uint64_t)tile_w + (uint64_t)(x - tx);
+}
+
+// Stats after `reps` replications, or with mid set, part way through its
+// block: cells the cursor has passed have the block's replications too.
+static void build_stats(Server *S, int reps, const SimCursor *mid, int send, int final) {
     size_t count = (size_t)S->world_w * (size_t)S->world_h;
     size_t floats_bytes = count * sizeof(float);
     size_t total_len = sizeof(MsgStatsHdr) + floats_bytes * 2u;
 
-    uint8_t *buf = (uint8_t*)malloc(total_len);
-    if (!buf) return;
+    uint8_t *buf = NULL;
+    if (send) {
+        buf = (uint8_t*)malloc(total_len);
+        if (!buf) return;
+    }
 
     MsgStatsHdr hdr = { .world_w = (uint32_t)S->world_w, .world_h = (uint32_t)S->world_h };
-    memcpy(buf, &hdr, sizeof(hdr));
-
-    float *prob = (float*)(buf + sizeof(hdr));
-    float *avg = prob + count;
+    float *prob = buf ? (float*)(buf + sizeof(hdr)) : NULL;
+    float *avg = buf ? prob + count : NULL;
 
+    double widest = 0.0;
     for (int y = 0; y < S->world_h; y++) {
         for (int x = 0; x < S->world_w; x++) {
-            int success = S->succesful_replications[y][x];
-            int steps = S->steps_to_center[y][x];
-            size_t idx = (size_t)y * (size_t)S->world_w + (size_t)x;
+            uint32_t success = S->succesful_replications[y][x];
+            int total_reps = S->base_replications + reps;
+            if (mid && tile_order(S, x, y) < mid->next_cell) total_reps += mid->rep_end - mid->rep_begin;
+
+            // Agresti-Coull interval, so cells with no hits yet still count as unsure.
+            if (!is_obstacle(S, x, y) && (x != S->world_w / 2 || y != S->world_h / 2)) {
+                double n = (double)total_reps + 4.0;
+                double p = ((double)success + 2.0) / n;
+                double half = 1.96 * sqrt(p * (1.0 - p) / n);
+                if (half > widest) widest = half;
+            }
+            if (!buf) continue;
 
-            prob[idx] = (float)success / (float)current_replication;
+            uint64_t steps = S->steps_to_center[y][x];
+            size_t idx = (size_t)y * (size_t)S->world_w + (size_t)x;
+            prob[idx] = (total_reps > 0) ? (float)((double)success / (double)total_reps) : 0.0f;
             if (success > 0) {
-                avg[idx] = (float)steps / ((float)success);
+                avg[idx] = (float)((double)steps / (double)success);
             } else {
                 avg[idx] = 0.0f;
             }
@@ -72,95 +153,250 @@ static void compute_and_send_stats(Server *S, int current_replication) {
             S->avg_steps_to_center[y][x] = avg[idx];
         }
     }
+    S->precision = (float)widest;
+    if (!buf) return;
+    hdr.precision = S->precision;
+    memcpy(buf, &hdr, sizeof(hdr));
 
-    clients_broadcast(S, MSG_STATS, buf, (uint32_t)total_len);
+    if (final) {
+        clients_broadcast_final(S, MSG_STATS, buf, (uint32_t)total_len);
+    } else {
+        clients_broadcast(S, MSG_STATS, buf, (uint32_t)total_len);
+    }
     free(buf);
 }
 
-void *sim_thread(void *arg) {
-    Server *S = (Server*)arg;
+// Budget runs report the widest interval at the end, so it is kept up to
+// date even when no stats frame is due. A frame that is not due stays
+// pending for sim_flush_stats.
+static void compute_and_send_stats(Server *S, int current_replication, int final) {
+    if (S->base_replications + current_replication <= 0) return;
+    int send = final ? server_wants(S, STREAM_STATS) : server_publish_due(S, STREAM_STATS);
+    S->stats_pending = !final && !send && server_wants(S, STREAM_STATS);
+    if (!send && S->budget_secs <= 0) return;
+    build_stats(S, current_replication, NULL, send, final);
+}
+
+// Sends pending stats once their gap is over, from the counts as they
+// stand: after `reps` replications, or part way through mid's block.
+void sim_flush_stats(Server *S, int reps, const SimCursor *mid) {
+    if (!S->stats_pending || !server_publish_due(S, STREAM_STATS)) return;
+    S->stats_pending = 0;
+    build_stats(S, reps, mid, 1, 0);
+}
 
+static int walk_from(Server *S, int x_spawn, int y_spawn, int *out_steps) {
     int center_x = S->world_w / 2;
     int center_y = S->world_h / 2;
-    for (int rep = 0; rep < S->replications && atomic_load(&S->running); rep++) {
-        for (int x_spawn = 0; x_spawn < S->world_w && atomic_load(&S->running); x_spawn++) {
-            for (int y_spawn = 0; y_spawn < S->world_h && atomic_load(&S->running); y_spawn++) {
-                if (x_spawn == center_x && y_spawn == center_y) continue;
-                if (is_obstacle(S, x_spawn, y_spawn)) continue;
-
-                atomic_store(&S->current_replication, rep + 1);
-                MsgProgress p = {
-                    .current_replication = (uint32_t)(rep + 1),
-                    .total_replications = (uint32_t)S->replications
-                };
-                clients_broadcast(S, MSG_PROGRESS, &p, sizeof(p));
-                atomic_store(&S->current_step, 0);
-
-                int x = x_spawn;
-                int y = y_spawn;
-
-                MsgStep st0 = { .x = x, .y = y, .step_index = 0 };
-                clients_broadcast(S, MSG_STEP, &st0, sizeof(st0));
-
-                pthread_mutex_lock(&S->hist_mtx);
-                if (S->history && S->history_cap > 0) {
-                    S->history[0] = st0;
-                }
-                pthread_mutex_unlock(&S->hist_mtx);
-
-                for (int step = 0; step < S->max_steps && atomic_load(&S->running); step++) {
-                    float r = get_random();
-                    int dx = 0, dy = 0;
-
-                    if (r < S->pU) dy = -1;
-                    else if (r < S->pU + S->pD) dy = +1;
-                    else if (r < S->pU + S->pD + S->pL) dx = -1;
-                    else dx = +1;
-
-                    int nx = (x + dx) % S->world_w;
-                    int ny = (y + dy) % S->world_h;
-                    if (nx < 0) nx += S->world_w;
-                    if (ny < 0) ny += S->world_h;
-                    if (!is_obstacle(S, nx, ny)) {
-                        x = nx;
-                        y = ny;
-                    }
+    int x = x_spawn;
+    int y = y_spawn;
+
+    for (int step = 0; step < S->max_steps && atomic_load(&S->running); step++) {
+        rwalk_step(S->walk, &S->rng, &x, &y);
+        if (x == center_x && y == center_y) {
+            *out_steps = step;
+            return 1;
+        }
+    }
+    return 0;
+}
 
-                    atomic_store(&S->current_step, step + 1);
+static int run_cell(Server *S, int x_spawn, int y_spawn, int rep_begin, int rep_end) {
+    uint32_t hits = 0;
+    uint64_t steps = 0;
+    for (int rep = rep_begin; rep < rep_end && atomic_load(&S->running) && !round_cut(S); rep++) {
+        server_progress(S, (uint32_t)(rep + 1), (uint32_t)S->replications);
 
-                    MsgStep st = {
-                        .x = x,
-                        .y = y,
-                        .step_index = step + 1
-                    };
-                    clients_broadcast(S, MSG_STEP, &st, sizeof(st));
+        int walk_steps = 0;
+        if (walk_from(S, x_spawn, y_spawn, &walk_steps)) {
+            steps += (uint64_t)walk_steps;
+            hits++;
+        }
+    }
+    if (!atomic_load(&S->running) || round_cut(S)) return 0;
+    if (hits) {
+        S->steps_to_center[y_spawn][x_spawn] += steps;
+        S->succesful_replications[y_spawn][x_spawn] += hits;
+    }
+    return 1;
+}
 
-                    pthread_mutex_lock(&S->hist_mtx);
-                    if (S->history && (step + 1) < S->history_cap) {
-                        S->history[step + 1] = st;
+static uint64_t run_block(Server *S, int rep_begin, int rep_end, uint64_t start_cell) {
+    int center_x = S->world_w / 2;
+    int center_y = S->world_h / 2;
+    uint64_t cell = 0;
+    for (int ty = 0; ty < S->world_h; ty += SIM_TILE) {
+        int y_end = (ty + SIM_TILE < S->world_h) ? ty + SIM_TILE : S->world_h;
+        for (int tx = 0; tx < S->world_w; tx += SIM_TILE) {
+            int x_end = (tx + SIM_TILE < S->world_w) ? tx + SIM_TILE : S->world_w;
+            for (int y_spawn = ty; y_spawn < y_end; y_spawn++) {
+                for (int x_spawn = tx; x_spawn < x_end; x_spawn++, cell++) {
+                    if (cell < start_cell) continue;
+                    if (x_spawn == center_x && y_spawn == center_y) continue;
+                    if (is_obstacle(S, x_spawn, y_spawn)) continue;
+                    uint64_t cell_rng = S->rng.s;
+                    if (!run_cell(S, x_spawn, y_spawn, rep_begin, rep_end)) {
+                        S->rng.s = cell_rng;
+                        return cell;
                     }
-                    pthread_mutex_unlock(&S->hist_mtx);
-
-                    if (S->steps_to_center && x == center_x && y == center_y) {
-                        S->steps_to_center[y_spawn][x_spawn] += step;
-                        S->succesful_replications[y_spawn][x_spawn]++;
-                        break;
+                    checkpoint_maybe(S, rep_begin, rep_end, cell + 1);
+                    if (S->stats_pending) {
+                        SimCursor mid = { .rep_begin = rep_begin, .rep_end = rep_end, .next_cell = cell + 1 };
+                        sim_flush_stats(S, rep_begin, &mid);
                     }
+                    if (slice_expired(S) || round_cut(S)) return cell + 1;
+                }
+            }
+        }
+    }
+    return cell;
+}
 
-                    if (atomic_load(&S->mode) != MODE_SUMMARY) {
-                        usleep((unsigned int)S->step_delay_ms * 1000u);
-                    }
+void sim_begin(Server *S) {
+    memset(&S->cursor, 0, sizeof(S->cursor));
+    if (S->resuming) {
+        S->cursor = S->resume;
+    } else {
+        S->cursor.rep_begin = S->cached_replications;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &S->last_checkpoint);
+
+    S->round_saved = 0;
+    S->rep_secs = 0.0;
+    if (S->budget_secs > 0) {
+        S->deadline = S->last_checkpoint;
+        S->deadline.tv_sec += S->budget_secs;
+    }
+    size_t count = (size_t)S->world_w * (size_t)S->world_h;
+    uint32_t *hits = (uint32_t*)realloc(S->round_hits, count * sizeof(*hits));
+    if (hits) S->round_hits = hits;
+    uint64_t *steps = (uint64_t*)realloc(S->round_steps, count * sizeof(*steps));
+    if (steps) S->round_steps = steps;
+    if (!hits || !steps) fprintf(stderr, "Interrupted blocks cannot be undone: out of memory.\n");
+}
+
+// Runs the current job from its cursor. With slice_ms > 0 it returns 0 at
+// the first cell boundary past the slice, leaving the cursor to continue
+// from; otherwise it runs until the job completes or is stopped and returns 1.
+int sim_advance(Server *S, int slice_ms) {
+    S->slice_active = (slice_ms > 0);
+    if (S->slice_active) {
+        clock_gettime(CLOCK_MONOTONIC, &S->slice_end);
+        S->slice_end.tv_sec += slice_ms / 1000;
+        S->slice_end.tv_nsec += (long)(slice_ms % 1000) * 1000000L;
+        if (S->slice_end.tv_nsec >= 1000000000L) {
+            S->slice_end.tv_sec++;
+            S->slice_end.tv_nsec -= 1000000000L;
+        }
+    }
+
+    uint64_t total_cells = (uint64_t)S->world_w * (uint64_t)S->world_h;
+    SimCursor *c = &S->cursor;
+    while (c->rep_begin < S->replications && atomic_load(&S->running)) {
+        if (c->next_cell == 0) {
+            int block = SIM_REP_BLOCK;
+            if (S->budget_secs > 0) {
+                block = budget_plan(S, c->rep_begin);
+                if (block == 0) {
+                    sim_budget_reached(S, c->rep_begin);
+                    break;
                 }
             }
+            round_save(S);
+            clock_gettime(CLOCK_MONOTONIC, &S->round_start);
+            c->rep_end = c->rep_begin + block;
+            if (c->rep_end > S->replications) c->rep_end = S->replications;
         }
-        compute_and_send_stats(S, rep + 1);
+
+        atomic_store(&S->current_replication, c->rep_end);
+        uint64_t next_cell = run_block(S, c->rep_begin, c->rep_end, c->next_cell);
+        if (next_cell < total_cells) {
+            c->next_cell = next_cell;
+            if (round_cut(S)) {
+                round_restore(S);
+                c->next_cell = 0;
+                sim_budget_reached(S, c->rep_begin);
+                break;
+            }
+            if (atomic_load(&S->running)) return 0;
+            checkpoint_now(S, c->rep_begin, c->rep_end, next_cell);
+            // The checkpoint keeps the part of the block that ran; results
+            // and stats only count whole blocks, so every cell has the same
+            // number of replications.
+            if (S->round_saved) {
+                round_restore(S);
+                atomic_store(&S->current_replication, c->rep_begin);
+            }
+            break;
+        }
+        c->next_cell = 0;
+        if (S->round_saved) {
+            S->round_saved = 0;
+            S->rep_secs = -secs_until(&S->round_start) / (double)(c->rep_end - c->rep_begin);
+        }
+        sim_publish(S, c->rep_end);
+        c->rep_begin = c->rep_end;
+    }
+    sim_finish(S, c->rep_begin >= S->replications);
+    return 1;
+}
+
+// Ends a budgeted job after `reps` whole replications: those become the
+// job's size, so progress and results read as a completed run.
+void sim_budget_reached(Server *S, int reps) {
+    S->replications = reps;
+    atomic_store(&S->current_replication, reps);
+    server_progress_final(S, (uint32_t)reps, (uint32_t)reps);
+    fprintf(stdout, "Time budget reached after %d replications, widest interval +-%.4f\n",
+            S->base_replications + reps, (double)S->precision);
+    fflush(stdout);
+}
+
+// Hands the accumulators after `reps` replications of this job to clients,
+// the results cache and, unless it is CSV, the results file.
+void sim_publish(Server *S, int reps) {
+    compute_and_send_stats(S, reps, 0);
+    cache_store(S, reps);
+    if (!results_is_csv_path(S->results_path)) {
+        write_results(S, reps);
+    }
+}
+
+void sim_finish(Server *S, int completed) {
+    if (completed) {
+        atomic_store(&S->completed, 1);
     }
-    compute_and_send_stats(S, atomic_load(&S->current_replication));
-    write_results(S);
+    int reps = atomic_load(&S->current_replication);
+    // Rate-limited clients may have skipped the last progress update.
+    server_progress_final(S, (uint32_t)reps, (uint32_t)S->replications);
+    compute_and_send_stats(S, reps, 1);
+    write_results(S, reps);
 
     MsgMode m = { .mode = MODE_SUMMARY };
     atomic_store(&S->mode, MODE_SUMMARY);
     clients_broadcast(S, MSG_MODE, &m, sizeof(m));
     atomic_store(&S->running, 0);
+}
+
+// The thread outlives its job: once a run ends it waits for the next MSG_JOB
+// and restarts in place until the server shuts down.
+void *sim_thread(void *arg) {
+    Server *S = (Server*)arg;
+    MsgJob job;
+    for (;;) {
+        if (S->shards > 1) {
+            shard_run(S);
+        } else {
+            sim_begin(S);
+            sim_advance(S, 0);
+        }
+        job_done(S);
+        int restarted = 0;
+        while (!restarted && job_wait(S, &job)) {
+            restarted = job_restart(S, &job);
+            if (!restarted) fprintf(stderr, "Job rejected; keeping the previous job.\n");
+        }
+        if (!restarted) break;
+    }
     return NULL;
 }
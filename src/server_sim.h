@@ -2,4 +2,11 @@
 
 #include "server_types.h"
 
+void sim_begin(Server *S);
+int sim_advance(Server *S, int slice_ms);
+void sim_publish(Server *S, int reps);
+void sim_flush_stats(Server *S, int reps, const SimCursor *mid);
+void sim_finish(Server *S, int completed);
+int sim_past_deadline(const Server *S);
+void sim_budget_reached(Server *S, int reps);
 void *sim_thread(void *arg);
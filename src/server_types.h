@@ -4,48 +4,156 @@
 #include <stdatomic.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "shared.h"
+#include "server_history.h"
+#include "server_outq.h"
+#include "server_results.h"
+#include "rng.h"
+#include "rwalk.h"
 
+typedef void (*ServerEmitFn)(void *ctx, uint32_t type, const void *payload, uint32_t len);
+
+#define CLIENT_MAX_MSG 1024
+
+// Subscription streams, in SubStream bit order.
+enum { STREAM_STEPS, STREAM_PROGRESS, STREAM_STATS, STREAM_OBSTACLES, STREAM_COUNT };
+
+struct Server;
+struct Host;
+struct NetLoop;
+
+// Connection state owned by the net loop thread. Other threads only push
+// into q and kick the loop, with the session's clients_mtx held.
 typedef struct Client {
     int fd;
+    struct Server *S;
+    OutQueue q;
+    Frame *out;
+    size_t out_off;
+    int want_out;
+    int closed;
+    int ops;
+    int sending;
+    int slab;
+    uint32_t slab_len, slab_off;
+    atomic_int kicked;
+    struct Client *kick_next;
+    struct timespec since;
+    uint32_t in_len;
+    uint8_t in[sizeof(MsgHdr) + CLIENT_MAX_MSG];
     struct Client *next;
+    struct Client *conn_prev, *conn_next;
+    // Guarded by the session's clients_mtx.
+    uint32_t subs;
+    int64_t gap_ns[STREAM_COUNT];
+    int64_t due_ns[STREAM_COUNT];
 } Client;
 
-typedef struct {
+typedef struct Server {
     int world_w, world_h;
     int step_delay_ms;
     int replications;
     int max_steps;
     float pU, pD, pL, pR;
     int base_replications;
-    FILE *results_fp;
-    int **steps_to_center;
-    int **succesful_replications;
+    // Replications of this job the results cache already supplied.
+    int cached_replications;
+    char base_file[256];
+    char results_path[256];
+    ResultsWriter writer;
+    uint64_t seed;
+    int seed_fixed;
+    int jobs;
+    Rng rng;
+    char checkpoint_path[256];
+    int checkpoint_secs;
+    ResultsWriter checkpoint;
+    struct timespec last_checkpoint;
+    SimCursor resume;
+    int resuming;
+    SimCursor cursor;
+    int slice_active;
+    struct timespec slice_end;
+    int budget_secs;
+    struct timespec deadline;
+    struct timespec round_start;
+    double rep_secs;
+    uint32_t *round_hits;
+    uint64_t *round_steps;
+    int round_saved;
+    float precision;
+    atomic_int completed;
+    char cache_path[256];
+    ResultsWriter cache;
+    uint64_t **steps_to_center;
+    uint32_t **succesful_replications;
     float **prob_to_center;
     float **avg_steps_to_center;
+    int alloc_w, alloc_h;
     uint8_t *obstacles;
     int obstacle_mode;
     float obstacle_density;
     char obstacle_file[256];
+    RwWorld *walk;
 
     atomic_uint mode;
 
     atomic_int current_replication;
     atomic_int current_step;
 
-    pthread_mutex_t hist_mtx;
-    MsgStep *history;
-    int history_cap;
+    StepHistory history;
+    int history_limit;
+
+    // The showcase thread holds showcase_mtx while it steps; job changes
+    // take it too. delay_us < 0 paces by step_delay_ms.
+    pthread_mutex_t showcase_mtx;
+    pthread_t showcase_th;
+    atomic_int showcase_on;
+    int showcase_delay_us;
+    // Set while a new job is built outside the locks; written with both
+    // showcase_mtx and clients_mtx held, read with either.
+    int restarting;
 
     pthread_mutex_t clients_mtx;
     Client *clients;
+    atomic_int subscribers[STREAM_COUNT];
+    // Progress and stats go out at most publish_hz times a second, 0 for
+    // every update. An update that comes too soon is kept and sent once
+    // the gap is over: progress by the showcase thread, stats by the job.
+    int publish_hz[STREAM_COUNT];
+    atomic_llong publish_due_ns[STREAM_COUNT];
+    atomic_ullong pending_progress; // current << 32 | total, 0 for none
+    int stats_pending;
+    OutqConfig outq;
+    struct NetLoop *loop;
+    ServerEmitFn emit;
+    void *emit_ctx;
 
     int listen_fd;
     char sock_path[RWALK_SOCK_MAX];
 
+    atomic_int alive;
     atomic_int running;
     atomic_int sim_started;
     atomic_int active_clients;
-    pthread_t accept_th, sim_th;
+    pthread_t sim_th;
+
+    pthread_mutex_t job_mtx;
+    pthread_cond_t job_cv;
+    MsgJob pending_job;
+    int job_pending;
+    int idle_secs;
+    int shards;
+
+    // Multi-session mode only; all guarded by the host's mutex except id.
+    struct Host *host;
+    struct Server *next_session;
+    char session_id[RWALK_SESSION_MAX];
+    int priority;
+    uint64_t vtime;
+    int runnable;
+    int active;
+    int on_cpu;
 } Server;
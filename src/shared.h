@@ -2,6 +2,7 @@
 #include <stdint.h>
 
 #define RWALK_SOCK_MAX 107
+#define RWALK_SESSION_MAX 64
 
 typedef enum {
     MSG_WELCOME = 1,
@@ -9,11 +10,26 @@ typedef enum {
     MSG_MODE    = 3,
     MSG_PROGRESS= 4,
     MSG_STOP    = 5,
-    MSG_ERROR   = 6,
+    MSG_ERROR   = 6,   // payload: message text, not NUL-terminated
     MSG_STATS   = 7,
     MSG_OBSTACLES = 8,
+    MSG_OBSTACLES_BITS = 9,
+    MSG_JOB     = 10,
+    MSG_SESSION = 11,
+    MSG_SUBSCRIBE = 12,
+    MSG_STEPS   = 13,
 } MsgType;
 
+// Streams a client can subscribe to. Welcome, mode and error messages
+// always go out; a client that never subscribes gets everything.
+typedef enum {
+    SUB_STEPS     = 1u << 0,
+    SUB_PROGRESS  = 1u << 1,
+    SUB_STATS     = 1u << 2,
+    SUB_OBSTACLES = 1u << 3,
+    SUB_ALL       = 0xfu,
+} SubStream;
+
 typedef enum {
     MODE_INTERACTIVE = 1,
     MODE_SUMMARY     = 2,
@@ -41,6 +57,23 @@ typedef struct {
     uint32_t step_index;
 } MsgStep;
 
+// A run of walk steps on the world torus. It continues from the step at
+// (x, y, step_index), which the receiver already has unless STEPS_HAS_START
+// marks it as the run's first step. `count` moves follow as 2-bit direction
+// codes (up, down, left, right), four to a byte from the low bits, each one
+// step index later. With STEPS_BLOCKED a bitmap of count bits follows; its
+// set bits are moves an obstacle stopped, which leave the walker in place.
+typedef struct {
+    int32_t x;
+    int32_t y;
+    uint32_t step_index;
+    uint32_t count;
+    uint32_t flags;
+} MsgStepsHdr;
+
+#define STEPS_HAS_START 1u
+#define STEPS_BLOCKED   2u
+
 typedef struct {
     uint32_t mode; 
 } MsgMode;
@@ -53,10 +86,41 @@ typedef struct {
 typedef struct {
     uint32_t world_w;
     uint32_t world_h;
+    float precision;   // widest 95% interval half-width of any cell's probability
 } MsgStatsHdr;
 
 typedef struct {
     uint32_t world_w;
     uint32_t world_h;
 } MsgObstaclesHdr;
+
+typedef struct {
+    int32_t world_w;
+    int32_t world_h;
+    int32_t step_delay_ms;
+    int32_t replications;
+    int32_t max_steps;
+    float pU, pD, pL, pR;
+    int32_t base_replications;
+    int32_t obstacle_mode;
+    float obstacle_density;
+    uint32_t mode;     // 0 keeps the current mode
+    char obstacle_file[256];
+    char results_path[256];
+    char base_file[256];
+    int32_t budget_secs;   // > 0: stop at this wall-clock budget, replications is a cap
+} MsgJob;
+
+typedef struct {
+    char session_id[RWALK_SESSION_MAX];
+    uint32_t priority;   // 0 keeps the session's priority
+} MsgSession;
+
+// Steps are paced by the walker and never thinned, so a gap cannot open
+// in the trail; the other rates cap updates per second, 0 sends them all.
+typedef struct {
+    uint32_t streams;    // SubStream bits
+    uint32_t progress_hz;
+    uint32_t stats_hz;
+} MsgSubscribe;
 #pragma pack(pop)
@@ -0,0 +1,93 @@
+#include "step_batch.h"
+
+#include <string.h>
+
+#include "rwalk.h"
+
+#define STEP_BLOCKED 4
+
+// The code for the move from a to b, STEP_BLOCKED when b stayed put, or -1
+// when b is not the very next step one cell on.
+static int step_code(const MsgStep *a, const MsgStep *b, int w, int h) {
+    if (b->step_index != a->step_index + 1u) return -1;
+    if (b->x == a->x && b->y == a->y) return STEP_BLOCKED;
+    if (b->x == a->x && b->y == (a->y + h - 1) % h) return RW_DIR_UP;
+    if (b->x == a->x && b->y == (a->y + 1) % h) return RW_DIR_DOWN;
+    if (b->y == a->y && b->x == (a->x + w - 1) % w) return RW_DIR_LEFT;
+    if (b->y == a->y && b->x == (a->x + 1) % w) return RW_DIR_RIGHT;
+    return -1;
+}
+
+// How many of steps, from steps[0], one MSG_STEPS run can carry.
+int steps_run(const MsgStep *steps, int n, int world_w, int world_h) {
+    int i = 1;
+    while (i < n && step_code(&steps[i - 1], &steps[i], world_w, world_h) >= 0) i++;
+    return (n > 0) ? i : 0;
+}
+
+// Packs steps[1..n-1] as moves on from steps[0], a run checked with
+// steps_run, into a MSG_STEPS payload. out needs STEPS_PAYLOAD_MAX(n - 1)
+// bytes. Returns the payload length.
+uint32_t steps_encode(const MsgStep *steps, int n, int has_start, int world_w, int world_h,
+                      uint8_t *out) {
+    uint32_t count = (n > 1) ? (uint32_t)(n - 1) : 0u;
+    size_t code_bytes = (count + 3u) / 4u;
+    uint8_t *codes = out + sizeof(MsgStepsHdr);
+    uint8_t *bits = codes + code_bytes;
+    memset(codes, 0, code_bytes + (count + 7u) / 8u);
+
+    int blocked = 0;
+    for (uint32_t k = 0; k < count; k++) {
+        int code = step_code(&steps[k], &steps[k + 1], world_w, world_h);
+        if (code == STEP_BLOCKED) {
+            bits[k >> 3] |= (uint8_t)(1u << (k & 7u));
+            blocked = 1;
+        } else {
+            codes[k >> 2] |= (uint8_t)(code << ((k & 3u) * 2u));
+        }
+    }
+
+    MsgStepsHdr hdr = {
+        .x = steps[0].x,
+        .y = steps[0].y,
+        .step_index = steps[0].step_index,
+        .count = count,
+        .flags = (has_start ? STEPS_HAS_START : 0u) | (blocked ? STEPS_BLOCKED : 0u)
+    };
+    memcpy(out, &hdr, sizeof(hdr));
+    return (uint32_t)(sizeof(hdr) + code_bytes + (blocked ? (count + 7u) / 8u : 0u));
+}
+
+// Unpacks a MSG_STEPS payload into out, or only counts its steps when out
+// is NULL. Returns the steps it holds, or -1 when it is malformed.
+int steps_decode(const uint8_t *payload, uint32_t len, int world_w, int world_h, MsgStep *out) {
+    MsgStepsHdr hdr;
+    if (len < sizeof(hdr) || world_w <= 0 || world_h <= 0) return -1;
+    memcpy(&hdr, payload, sizeof(hdr));
+    size_t code_bytes = ((size_t)hdr.count + 3u) / 4u;
+    size_t bit_bytes = (hdr.flags & STEPS_BLOCKED) ? ((size_t)hdr.count + 7u) / 8u : 0u;
+    if (len != sizeof(hdr) + code_bytes + bit_bytes || hdr.count > (uint32_t)INT32_MAX - 1u) return -1;
+    if (hdr.x < 0 || hdr.x >= world_w || hdr.y < 0 || hdr.y >= world_h) return -1;
+    int has_start = (hdr.flags & STEPS_HAS_START) != 0;
+    int n = (int)hdr.count + has_start;
+    if (!out) return n;
+
+    const uint8_t *codes = payload + sizeof(hdr);
+    const uint8_t *bits = codes + code_bytes;
+    MsgStep cur = { .x = hdr.x, .y = hdr.y, .step_index = hdr.step_index };
+    int i = 0;
+    if (has_start) out[i++] = cur;
+    for (uint32_t k = 0; k < hdr.count; k++) {
+        cur.step_index++;
+        if (!bit_bytes || !((bits[k >> 3] >> (k & 7u)) & 1u)) {
+            switch ((codes[k >> 2] >> ((k & 3u) * 2u)) & 3u) {
+            case RW_DIR_UP:    cur.y = (cur.y - 1 + world_h) % world_h; break;
+            case RW_DIR_DOWN:  cur.y = (cur.y + 1) % world_h; break;
+            case RW_DIR_LEFT:  cur.x = (cur.x - 1 + world_w) % world_w; break;
+            default:           cur.x = (cur.x + 1) % world_w; break;
+            }
+        }
+        out[i++] = cur;
+    }
+    return n;
+}
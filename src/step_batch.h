@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "shared.h"
+
+// Largest MSG_STEPS payload for a run of count moves.
+#define STEPS_PAYLOAD_MAX(count) (sizeof(MsgStepsHdr) + ((count) + 3u) / 4u + ((count) + 7u) / 8u)
+
+int steps_run(const MsgStep *steps, int n, int world_w, int world_h);
+uint32_t steps_encode(const MsgStep *steps, int n, int has_start, int world_w, int world_h,
+                      uint8_t *out);
+int steps_decode(const uint8_t *payload, uint32_t len, int world_w, int world_h, MsgStep *out);
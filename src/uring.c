@@ -0,0 +1,111 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// One mmap for both rings, timeouts on enter, no dropped completions.
+#define URING_NEED_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP)
+
+int uring_init(Uring *r, unsigned entries) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) return 0;
+    if ((p.features & URING_NEED_FEATURES) != URING_NEED_FEATURES) {
+        close(fd);
+        errno = ENOSYS;
+        return 0;
+    }
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->ring_len = (sq_len > cq_len) ? sq_len : cq_len;
+    r->ring = mmap(NULL, r->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQ_RING);
+    if (r->ring == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->ring, r->ring_len);
+        close(fd);
+        return 0;
+    }
+
+    uint8_t *base = (uint8_t*)r->ring;
+    r->sq_head = (unsigned*)(base + p.sq_off.head);
+    r->sq_tail = (unsigned*)(base + p.sq_off.tail);
+    r->sq_mask = (unsigned*)(base + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(base + p.sq_off.array);
+    r->cq_head = (unsigned*)(base + p.cq_off.head);
+    r->cq_tail = (unsigned*)(base + p.cq_off.tail);
+    r->cq_mask = (unsigned*)(base + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(base + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+    r->tail = *r->sq_tail;
+    r->fd = fd;
+    return 1;
+}
+
+void uring_free(Uring *r) {
+    if (r->fd < 0) return;
+    munmap(r->sqes, r->sqes_len);
+    munmap(r->ring, r->ring_len);
+    close(r->fd);
+    r->fd = -1;
+}
+
+// NULL when the submission ring is full; submit and try again.
+struct io_uring_sqe *uring_sqe(Uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->tail - head >= r->entries) return NULL;
+    unsigned idx = r->tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->tail++;
+    return sqe;
+}
+
+// Submits everything queued and waits for up to wait_nr completions, or
+// timeout_ms when that is >= 0. Returns -1 only on real errors.
+int uring_submit(Uring *r, unsigned wait_nr, int timeout_ms) {
+    __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+    unsigned pending = r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (long long)(timeout_ms % 1000) * 1000000ll
+    };
+    struct io_uring_getevents_arg arg = { .ts = (uint64_t)(uintptr_t)&ts };
+    void *argp = NULL;
+    size_t argsz = 0;
+    if (wait_nr && timeout_ms >= 0) {
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+    int rc = (int)syscall(__NR_io_uring_enter, r->fd, pending, wait_nr, flags, argp, argsz);
+    if (rc < 0 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN) return -1;
+    return 0;
+}
+
+int uring_reap(Uring *r, struct io_uring_cqe *out) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    *out = r->cqes[head & *r->cq_mask];
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int uring_register_buffers(Uring *r, const struct iovec *iov, unsigned n) {
+    return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, n) == 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+// Minimal io_uring over the raw syscalls; no liburing. SQEs handed out by
+// uring_sqe are sent with the next uring_submit, so everything queued in
+// one pass goes to the kernel in a single io_uring_enter.
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *ring;
+    size_t ring_len;
+    size_t sqes_len;
+    unsigned entries;
+    unsigned tail;
+} Uring;
+
+int uring_init(Uring *r, unsigned entries);
+void uring_free(Uring *r);
+struct io_uring_sqe *uring_sqe(Uring *r);
+int uring_submit(Uring *r, unsigned wait_nr, int timeout_ms);
+int uring_reap(Uring *r, struct io_uring_cqe *out);
+int uring_register_buffers(Uring *r, const struct iovec *iov, unsigned n);